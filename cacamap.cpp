@@ -1,708 +1,1720 @@
 #include "cacamap.h"
 #include <iostream>
+#include <cmath>
 
 using namespace std;
 
-servermanager::servermanager()
+/**
+* constructor
+*/
+cacaMap::cacaMap(QPointF startcoords,
+                 bool enable_download,
+                 QWidget* parent):QWidget(parent), tileSize(256), enable_downloading(enable_download)
+{
+	minZoom = 0;
+	overzoomLevels = 0;
+	composeChildren = true;
+	composeStore = false;
+	folder = QDir::currentPath();
+	servermgr.load(folder+"/tileservers.xml");
+	maxZoom = servermgr.maxZoom();
+	storeFlushPending = false;
+	prefetchRing = 1;
+	hasZoomTarget = false;
+	panClock.start();
+	layerVersion = 0;
+	compositeCache.setMaxBytes(32*1024*1024);
+	source = 0;
+	sources.fill(0,servermgr.count());
+	tileSource *first = createSource(servermgr.currentServer());
+	memCacheBudget = first->memCache.maxBytes();
+	useSource(first);
+    geocoords = startcoords;
+	zoom = 14;
+	loadingAnim.setFileName("loading.gif");
+	loadingAnim.setScaledSize(QSize(tileSize,tileSize));
+	loadingAnim.start();
+	notAvailableTile.load("notavailable.jpeg");
+	imgBuffer = new QPixmap(size());
+	bufferDirty = true;
+	bufferTiles = tileSet();
+	fracZoom = 0;
+	contentPending = false;
+	frameClock.start();
+	frameTimer.setSingleShot(true);
+	connect(&frameTimer, SIGNAL(timeout()), this, SLOT(slotFrame()));
+}
+
+/**
+Sets the latitude and longitude to the coords in newcoords
+@param newcoords the new coordinates.
+*/
+void cacaMap::setGeoCoords(QPointF newcoords)
+{
+	geocoords = newcoords;
+}
+/**
+* zooms in one level
+* @return true if it zoomed succesfully, false otherwise (if maxZoom has been reached)
+*/
+bool cacaMap::zoomIn()
+{
+	if (zoom < maxZoom)
+	{
+		zoom++;
+		fracZoom = 0;
+		hasZoomTarget = false;
+		loader->cancelPending();
+		updateContent();
+		return true;
+	}
+	return false;
+}
+/**
+* zooms out one level
+* @return true if it zoomed succesfully, false otherwise (if minZoom has been reached)
+*/
+bool cacaMap::zoomOut()
+{
+	if (zoom > minZoom)
+	{
+		zoom--;
+		fracZoom = 0;
+		hasZoomTarget = false;
+		loader->cancelPending();
+		updateContent();
+		return true;
+	}
+	return false;
+}
+
+/**
+* zooms to a specific level
+* @return true if it is a valid level, false otherwise (if level is outside the valid range)
+*/
+bool cacaMap::setZoom(int level)
+{
+	if (level>= minZoom && level <= maxZoom)
+	{
+		zoom = level;
+		fracZoom = 0;
+		hasZoomTarget = false;
+		loader->cancelPending();
+		updateContent();
+		return true;
+	}
+	return false;
+}
+
+/**
+* zooms to a fractional level, e.g. while animating or for wheel and pinch zoom
+* The buffer holds the tiles of the level below, which are magnified when
+* painted and blended with the cached tiles of the level above.
+* @param level zoom level, clamped to the valid range
+* @return false if the map was already there
+*/
+bool cacaMap::setZoomF(qreal level)
+{
+	level = qBound((qreal)minZoom, level, (qreal)maxZoom);
+	int base = qFloor(level);
+	qreal frac = level - base;
+	if (base == zoom && qFuzzyCompare(1 + frac, 1 + fracZoom))
+	{
+		return false;
+	}
+	fracZoom = frac;
+	if (base != zoom)
+	{
+		zoom = base;
+		hasZoomTarget = false;
+		loader->cancelPending();
+		updateContent();
+	}
+	return true;
+}
+
+/**
+*   @return current zoom level, with its fractional part
+*/
+qreal cacaMap::getZoomF()
+{
+	return zoom + fracZoom;
+}
+
+/**
+* @return current geocoords
+*/
+QPointF cacaMap::getGeoCoords()
+{
+	return geocoords;
+}
+
+void cacaMap::setEnableDownloadTiles(bool enabled)
+{
+    enable_downloading = enabled;
+    if (enable_downloading == false)
+    {
+        for (int i=0; i<sources.size(); i++)
+        {
+            if (sources.at(i))
+            {
+                sources.at(i)->downloader->clearQueue();
+            }
+        }
+    }
+    //TODO: signal
+}
+
+bool cacaMap::enabledDownloadTiles() const
+{
+    return enable_downloading;
+}
+
+/**
+* Sets how many tiles can be downloaded at the same time
+* @param downloads maximum number of requests in flight
+* @param perhost maximum number of requests in flight to the same tile server,
+* -1 keeps the current limit
+*/
+void cacaMap::setMaxConcurrentDownloads(int downloads, int perhost)
+{
+    for (int i=0; i<sources.size(); i++)
+    {
+        if (sources.at(i))
+        {
+            sources.at(i)->downloader->setMaxConcurrent(downloads);
+            if (perhost >= 0)
+            {
+                sources.at(i)->downloader->setMaxPerHost(perhost);
+            }
+        }
+    }
+}
+
+/**
+* @return maximum number of tile requests in flight
+*/
+int cacaMap::maxConcurrentDownloads() const
+{
+    return downloader->maxConcurrent();
+}
+
+/**
+* @return maximum number of tile requests in flight to the same tile server
+*/
+int cacaMap::maxDownloadsPerHost() const
+{
+    return downloader->maxPerHost();
+}
+
+/**
+* Sets how many tiles are downloaded ahead of time
+* A ring around the viewport is prefetched, stretched in the direction of the pan,
+* along with the tiles of the next zoom level around the center.
+* Prefetches only go when no visible tile is waiting.
+* @param margin width of the ring in tiles, -1 disables prefetching
+* @param downloads maximum number of prefetch requests in flight
+*/
+void cacaMap::setPrefetch(int margin, int downloads)
+{
+    prefetchRing = qMax(-1, margin);
+    for (int i=0; i<sources.size(); i++)
+    {
+        if (sources.at(i))
+        {
+            sources.at(i)->downloader->setMaxPrefetches(downloads);
+        }
+    }
+    prefetchTiles();
+}
+
+int cacaMap::prefetchMargin() const
+{
+    return prefetchRing;
+}
+
+int cacaMap::maxPrefetchDownloads() const
+{
+    return downloader->maxPrefetches();
+}
+
+/**
+* Lets the map zoom in past the deepest zoom level of the tile server
+* Those levels are never downloaded, they are drawn by scaling up the
+* cached tiles of the server's max zoom.
+* @param levels number of extra zoom levels, 0 disables overzoom
+*/
+void cacaMap::setOverzoom(int levels)
+{
+    overzoomLevels = qBound(0, levels, OVERZOOM_MAX_LEVELS);
+    maxZoom = servermgr.maxZoom() + overzoomLevels;
+    zoomRangeChanged();
+    if (zoom > maxZoom)
+    {
+        setZoom(maxZoom);
+    }
+}
+
+/**
+* @return number of zoom levels past the server's max zoom
+*/
+int cacaMap::overzoom() const
+{
+    return overzoomLevels;
+}
+
+/**
+* Sets the memory budget for the patches shown in place of missing tiles
+* @param bytes maximum size in bytes of the patch cache
+*/
+void cacaMap::setPatchCacheSize(int bytes)
+{
+    patchCache.setMaxBytes(bytes);
+}
+
+int cacaMap::patchCacheSize() const
+{
+    return patchCache.maxBytes();
+}
+
+/**
+* Builds tiles that aren't cached out of their four cached children,
+* so zooming out over an area already browsed needs no downloads
+* @param enabled compose missing tiles from their children
+* @param writeback also save the composed tiles in the %tile store
+*/
+void cacaMap::setComposeFromChildren(bool enabled, bool writeback)
+{
+    composeChildren = enabled;
+    composeStore = writeback;
+}
+
+bool cacaMap::composeFromChildren() const
+{
+    return composeChildren;
+}
+
+bool cacaMap::composeWriteBack() const
+{
+    return composeStore;
+}
+
+/**
+* @return names of the tile servers read from tileservers.xml
+*/
+QStringList cacaMap::tileServers() const
+{
+    return servermgr.serverNames();
+}
+
+/**
+* @return index of the tile server shown
+*/
+int cacaMap::tileServer() const
+{
+    return servermgr.currentServer();
+}
+
+/**
+* Shows another tile server
+* Every server has its own cache folder, index, decoded tiles and download queue,
+* switching back to a server shown before picks them up as they were left.
+* @param index index in tileServers()
+* @return false if there's no such server
+*/
+bool cacaMap::setTileServer(int index)
+{
+    if (index == servermgr.currentServer())
+    {
+        return true;
+    }
+    if (!servermgr.setCurrentServer(index))
+    {
+        return false;
+    }
+    //the downloads in flight still end up in the store of their server
+    downloader->clearQueue();
+    loader->cancelPending();
+    slotFlushStore();
+    if (!sources.at(index))
+    {
+        createSource(index);
+    }
+    useSource(sources.at(index));
+    patchCache.clear();
+    maxZoom = servermgr.maxZoom() + overzoomLevels;
+    zoomRangeChanged();
+    zoom = qMin(zoom, maxZoom);
+    layersChanged();
+    return true;
+}
+
+/**
+* Draws a tile server on top of the base map and the layers added before
+* The layer has its own cache folder, index and download queue, like the base map.
+* @param server index in tileServers()
+* @param opacity 0 is transparent, 1 opaque
+* @return index of the layer, -1 if there's no such server
+*/
+int cacaMap::addLayer(int server, qreal opacity)
+{
+    if (server < 0 || server >= sources.size())
+    {
+        return -1;
+    }
+    if (!sources.at(server))
+    {
+        createSource(server);
+    }
+    mapLayer layer;
+    layer.server = server;
+    layer.opacity = qBound((qreal)0, opacity, (qreal)1);
+    layers.append(layer);
+    sources.at(server)->memCache.setMaxBytes(memCacheBudget);
+    layersChanged();
+    return layers.size()-1;
+}
+
+/**
+* Stops drawing a layer, the ones above it move down one index
+* @return false if there's no such layer
+*/
+bool cacaMap::removeLayer(int layer)
+{
+    if (layer < 0 || layer >= layers.size())
+    {
+        return false;
+    }
+    tileSource *src = sources.at(layers.at(layer).server);
+    layers.removeAt(layer);
+    if (!isShown(src))
+    {
+        src->downloader->clearQueue();
+        src->loader->cancelPending();
+        src->memCache.setMaxBytes(memCacheBudget/IDLE_SOURCE_MEMCACHE_SHARE);
+    }
+    layersChanged();
+    return true;
+}
+
+/**
+* Removes all the layers, only the base map is drawn
+*/
+void cacaMap::clearLayers()
+{
+    while (!layers.isEmpty())
+    {
+        removeLayer(layers.size()-1);
+    }
+}
+
+int cacaMap::layerCount() const
+{
+    return layers.size();
+}
+
+/**
+* @param layer index of the layer
+* @param opacity 0 is transparent, 1 opaque
+* @return false if there's no such layer
+*/
+bool cacaMap::setLayerOpacity(int layer, qreal opacity)
+{
+    if (layer < 0 || layer >= layers.size())
+    {
+        return false;
+    }
+    layers[layer].opacity = qBound((qreal)0, opacity, (qreal)1);
+    layersChanged();
+    return true;
+}
+
+/**
+* @return opacity of a layer, 0 if there's no such layer
+*/
+qreal cacaMap::layerOpacity(int layer) const
+{
+    if (layer < 0 || layer >= layers.size())
+    {
+        return 0;
+    }
+    return layers.at(layer).opacity;
+}
+
+/**
+* Adds something to draw on top of the map, e.g. a featureOverlay
+* Overlays are drawn in the order they were added. Call update() after
+* changing the contents of an overlay.
+*/
+void cacaMap::addOverlay(QSharedPointer<mapOverlay> overlay)
+{
+    overlays.append(overlay);
+    update();
+}
+
+/**
+* @return false if the overlay wasn't added
+*/
+bool cacaMap::removeOverlay(QSharedPointer<mapOverlay> overlay)
+{
+    if (!overlays.removeOne(overlay))
+    {
+        return false;
+    }
+    update();
+    return true;
+}
+
+/**
+* @return the tiles on screen and where they are, at the integer zoom level
+* At fractional zoom levels they are magnified when painted, points of the
+* widget have to go through mapToView() before being looked up in them.
+*/
+tileSet cacaMap::getVisibleTiles() const
+{
+    return tilesToRender;
+}
+
+/**
+* @return size in px of the square %tile
+*/
+int cacaMap::getTileSize() const
+{
+    return tileSize;
+}
+
+/**
+* @return where a point of the widget is in the tiles of getVisibleTiles(),
+* undoing the magnification of fractional zoom levels
+*/
+QPoint cacaMap::mapToView(QPoint pos) const
+{
+    return zoomTransform().inverted().map(QPointF(pos)).toPoint();
+}
+
+/**
+* Finds the features of an overlay under a point of the widget, e.g. a click
+* @param overlay overlay to look in
+* @param pos point of the widget in px
+* @param tolerance how far off the point can be, in px of the widget
+* @return ids of the features, the topmost one first
+*/
+QList<int> cacaMap::featuresAt(const featureOverlay &overlay, QPoint pos, int tolerance) const
+{
+    int scaled = qCeil(tolerance/qPow(2,fracZoom));
+    return overlay.featuresAt(tilesToRender, mapToView(pos), tileSize, scaled);
+}
+
+/**
+* The blended tiles of the old layer set aren't used anymore, everything is redrawn
+*/
+void cacaMap::layersChanged()
+{
+    layerVersion++;
+    compositeCache.clear();
+    bufferDirty = true;
+    updateContent();
+    update();
+}
+
+/**
+* Sets the maximum space allowed for caching tiles on disk, for each tile server
+* The least recently used tiles are deleted in the background when it's exceeded.
+* @param bytes budget in bytes
+*/
+void cacaMap::setDiskCacheSize(qint64 bytes)
+{
+    for (int i=0; i<sources.size(); i++)
+    {
+        if (sources.at(i))
+        {
+            sources.at(i)->tileCache->setMaxSize(bytes);
+        }
+    }
+}
+
+/**
+* @return maximum space in bytes allowed for caching tiles on disk
+*/
+qint64 cacaMap::diskCacheSize() const
+{
+    return tileCache->maxSize();
+}
+
+/**
+* @return space in bytes currently used by cached tiles on disk
+*/
+qint64 cacaMap::diskCacheUsed() const
+{
+    return tileCache->totalSize();
+}
+
+/**
+* Sets the memory budget for decoded tiles
+* The tile servers that aren't shown keep a share of it.
+* @param bytes maximum size in bytes of the in-memory %tile cache
+*/
+void cacaMap::setMemCacheSize(int bytes)
+{
+    memCacheBudget = bytes;
+    for (int i=0; i<sources.size(); i++)
+    {
+        if (sources.at(i))
+        {
+            sources.at(i)->memCache.setMaxBytes(isShown(sources.at(i)) ? bytes : bytes/IDLE_SOURCE_MEMCACHE_SHARE);
+        }
+    }
+}
+
+/**
+* @return memory budget in bytes for decoded tiles
+*/
+int cacaMap::memCacheSize() const
 {
-    tileserver serveritem;
+    return memCacheBudget;
+}
 
-    serveritem.name = "OSM cahced";
-    //serveritem.url = "http://a.tile.openstreetmap.org/%z/%x/%y.png";
-    serveritem.url = "http://mt1.google.com/vt/x=%x&y=%y&z=%z";
-    serveritem.folder = "map_cache";
-    serveritem.path = "/%z/%x/";
-    serveritem.tile = "%y.png";
+/**
+* @return number of tiles served from memory
+*/
+quint64 cacaMap::memCacheHits() const
+{
+    return memCache->hits();
+}
 
-    servermain = serveritem;
+/**
+* @return number of tiles that had to be read from disk
+*/
+quint64 cacaMap::memCacheMisses() const
+{
+    return memCache->misses();
 }
 
+/**
+* Sets how long a %tile the server answered with a 404 is not requested again
+* @param secs time in seconds
+*/
+void cacaMap::setMissingTileTtl(qint64 secs)
+{
+    for (int i=0; i<sources.size(); i++)
+    {
+        if (sources.at(i))
+        {
+            sources.at(i)->unavailableTiles.setTtl(secs);
+        }
+    }
+}
 
+qint64 cacaMap::missingTileTtl() const
+{
+    return unavailableTiles->ttl();
+}
 /**
-* Get URL of a specific %tile
-* @param zoom zoom level
-* @return string containing the url where the %tile image can be found.
+*   @return current zoom level
 */
-QString servermanager::getTileUrl(int zoom, quint32 x, quint32 y)
+int cacaMap::getZoom()
 {
-    QString sz,sx,sy;
-    sz.setNum(zoom);
-    sx.setNum(x);
-    sy.setNum(y);
-    QString urltmpl = servermain.url;
+	return zoom;
+}	
 
-    urltmpl.replace(QString("%z"),sz);
-    urltmpl.replace(QString("%x"),sx);
-    urltmpl.replace(QString("%y"),sy);
-    return urltmpl;
+/**
+* Gets the decoded image of a cached %tile
+* Only the in-memory cache is checked. On a miss the %tile is queued to be read
+* and decoded on the loader threads, and the %tile is redrawn when it's ready.
+* @param key %tile to load
+* @param image receives the decoded %tile
+* @return true if the image was already decoded
+* @see cacaMap::slotTileLoaded
+*/
+bool cacaMap::loadTile(const tileKey &key, QPixmap &image)
+{
+	if (memCache->find(key,image))
+	{
+		return true;
+	}
+	loader->request(key);
+	return false;
 }
 
 /**
-* @return name of the cache folder for the given tile server
+* @return image for temporarily replacing a tile that is downloading and currently unavailable
+* The 'patch' is a subsection of an available tile from a lower zoom level, scaled up.
+* The closest decoded ancestor is used, the higher the zoom level difference
+* the more pixelated the patch will be.
+* Patches are cached, so each (tile, ancestor) pair is only cut and scaled once.
+* @param key %tile to replace
 */
-QString servermanager::tileCacheFolder()
+QPixmap cacaMap::getTilePatch(const tileKey &key)
 {
-    return  servermain.folder;
+	//dont use patches smaller than 16 px, they are unintelligible anyways.
+	//past the server's max zoom patches are all there is, so they can be smaller
+	int minsize = PATCH_MIN_SIZE;
+	if (key.zoom() > servermgr.maxZoom())
+	{
+		minsize = qMax(1, PATCH_MIN_SIZE>>(key.zoom() - servermgr.maxZoom()));
+	}
+	tileKey ancestor = key;
+	//dont go beyond level 0
+	for (int dz=1; dz<=key.zoom() && (tileSize>>dz) >= minsize; dz++)
+	{
+		ancestor = ancestor.parent();
+		QPixmap patch;
+		if (patchCache.find(key,dz,patch))
+		{
+			return patch;
+		}
+		//if the ancestor is on disk but not decoded yet keep looking further up
+		//while it loads
+		if (tileCache->touch(ancestor) && loadTile(ancestor,patch))
+		{
+			int size = tileSize>>dz;
+			quint32 mask = (1u<<dz) - 1;
+			patch = patch.copy((key.x() & mask)*size,(key.y() & mask)*size,size,size)
+				.scaled(tileSize,tileSize,Qt::IgnoreAspectRatio,Qt::SmoothTransformation);
+			patchCache.insert(key,dz,patch);
+			return patch;
+		}
+	}
+	return loadingAnim.currentPixmap();
 }
 
+
+
 /**
-* @return tile file name
+* Gets a %tile that isn't cached by scaling down its four children, if they are
+* The children are read and composed on the loader threads, a patch is shown meanwhile.
+* @param key %tile to compose
+* @param image receives the composed %tile, or a patch while it's being composed
+* @return false if some child isn't cached, the %tile has to be downloaded then
+* @see cacaMap::slotTileComposed
 */
-QString servermanager::fileName(quint32 y)
+bool cacaMap::composeTile(const tileKey &key, QPixmap &image)
 {
-    QString filetmpl = servermain.tile;
-    QString sy;
-    sy.setNum(y);
-    filetmpl.replace("%y",sy);
-    return filetmpl;
+	if (!composeChildren || uncomposable->contains(key))
+	{
+		return false;
+	}
+	for (int i=0; i<4; i++)
+	{
+		if (!tileCache->contains(key.child(i)))
+		{
+			return false;
+		}
+	}
+	if (!memCache->find(key,image))
+	{
+		for (int i=0; i<4; i++)
+		{
+			tileCache->touch(key.child(i));
+		}
+		loader->compose(key,composeStore);
+		image = getTilePatch(key);
+	}
+	return true;
 }
 
 /**
-* @return tile file path
+* Creates the folder, index, loader and download queue of a tile server
+* The settings are copied from the source shown so far.
+* @param server index of the tile server
 */
-QString servermanager::filePath(int zoom, quint32 x)
+tileSource *cacaMap::createSource(int server)
 {
-    QString filetmpl = servermain.path;
-    QString sz, sx;
-    sz.setNum(zoom);
-    sx.setNum(x);
-    filetmpl.replace("%z",sz);
-    filetmpl.replace("%x",sx);
-    return filetmpl;
+	tileSource *src = new tileSource;
+	src->layout = servermgr;
+	src->layout.setCurrentServer(server);
+	src->store = new dirTileStore(folder,src->layout);
+	src->tileCache = new tileDiskCache(src->store,this);
+	connect(src->tileCache, SIGNAL(indexReset()),this, SLOT(slotCacheIndexReset()));
+	connect(src->tileCache, SIGNAL(tilesEvicted(QList<tileKey>)),this, SLOT(slotTilesEvicted(QList<tileKey>)));
+	src->loader = new tileLoader(src->store,this);
+	connect(src->loader, SIGNAL(tileLoaded(tileKey,QImage)),this, SLOT(slotTileLoaded(tileKey,QImage)));
+	connect(src->loader, SIGNAL(tileUnreadable(tileKey)),this, SLOT(slotTileUnreadable(tileKey)));
+	connect(src->loader, SIGNAL(tileComposed(tileKey,QImage,QByteArray)),this, SLOT(slotTileComposed(tileKey,QImage,QByteArray)));
+	src->downloader = new tileDownloader(this);
+	connect(src->downloader, SIGNAL(tileReady(tileKey,QByteArray,tileFreshness)),this, SLOT(slotDownloadReady(tileKey,QByteArray,tileFreshness)));
+	connect(src->downloader, SIGNAL(tileNotModified(tileKey,tileFreshness)),this, SLOT(slotTileNotModified(tileKey,tileFreshness)));
+	connect(src->downloader, SIGNAL(tileFailed(tileKey,QNetworkReply::NetworkError)),this, SLOT(slotDownloadFailed(tileKey,QNetworkReply::NetworkError)));
+	if (source)
+	{
+		src->tileCache->setMaxSize(tileCache->maxSize());
+		src->downloader->setMaxConcurrent(downloader->maxConcurrent());
+		src->downloader->setMaxPerHost(downloader->maxPerHost());
+		src->downloader->setMaxPrefetches(downloader->maxPrefetches());
+		src->unavailableTiles.setTtl(unavailableTiles->ttl());
+		src->memCache.setMaxBytes(memCacheBudget);
+	}
+	sources[server] = src;
+	loadCache(src);
+	return src;
 }
 
+/**
+* Makes a source the current one, the one that is drawn and downloaded
+* The previous one keeps a share of the memory budget, unless it's a layer.
+*/
+void cacaMap::useSource(tileSource *src)
+{
+	if (source && !isLayer(source))
+	{
+		source->memCache.setMaxBytes(memCacheBudget/IDLE_SOURCE_MEMCACHE_SHARE);
+	}
+	source = src;
+	store = src->store;
+	tileCache = src->tileCache;
+	loader = src->loader;
+	downloader = src->downloader;
+	unavailableTiles = &src->unavailableTiles;
+	memCache = &src->memCache;
+	uncomposable = &src->uncomposable;
+	memCache->setMaxBytes(memCacheBudget);
+}
 
 /**
-* @return server name
+* @return the source a disk cache, loader or downloader belongs to, 0 if none
 */
-QString servermanager::serverName()
+tileSource *cacaMap::sourceOf(QObject *obj) const
 {
-    return servermain.name;
+	for (int i=0; i<sources.size(); i++)
+	{
+		tileSource *src = sources.at(i);
+		if (src && (obj == src->tileCache || obj == src->loader || obj == src->downloader))
+		{
+			return src;
+		}
+	}
+	return 0;
 }
+
 /**
-* constructor
+* @return true if a source is drawn as one of the layers
 */
-longPoint::longPoint(quint32 _x, quint32 _y)
+bool cacaMap::isLayer(tileSource *src) const
 {
-	x = _x;
-	y = _y;
+	for (int i=0; i<layers.size(); i++)
+	{
+		if (sources.at(layers.at(i).server) == src)
+		{
+			return true;
+		}
+	}
+	return false;
 }
+
 /**
-*empty constructor
+* @return true if a source is drawn, as the base map or as a layer
 */
+bool cacaMap::isShown(tileSource *src) const
+{
+	return src == source || isLayer(src);
+}
 
-longPoint::longPoint()
+/**
+* @return the base map source followed by the sources of the layers, each one once
+*/
+QList<tileSource*> cacaMap::shownSources() const
 {
-	x = 0;
-	y = 0;
+	QList<tileSource*> shown;
+	shown.append(source);
+	for (int i=0; i<layers.size(); i++)
+	{
+		tileSource *src = sources.at(layers.at(i).server);
+		if (!shown.contains(src))
+		{
+			shown.append(src);
+		}
+	}
+	return shown;
 }
 
 /**
-* Converts a geo coordinate to map pixels
-* @param geocoord has the longitude and latitude in degrees.
-* @param zoom is the zoom level, ranges from cacaMap::minZoom (out) to maxZoom (in).
-* @param tilesize the width/height in px of the square %tile (e.g 256).
-* @return a longpoint struct containing the x and y px coordinates
-* in the map for the given geocoordinates and zoom level.
+Populates the cache list of a source from the index saved next to its %tile store
+If there's no usable index the store is rescanned in the background.
 */
-longPoint myMercator::geoCoordToPixel(QPointF const &geocoord, int zoom, int tilesize)
+void cacaMap::loadCache(tileSource *src)
 {
- 	qreal  longitude = geocoord.x();
-	qreal  latitude = geocoord.y();
-	
-	//height, width of the whole map,this is, all tiles for a given zoom level put together
-	quint32 mapsize =  (1<<zoom)*tilesize;
-	
-	qreal latitude_m = atanh(sin(latitude/180.0*M_PI))*180.0/M_PI;
+	src->memCache.clear();
+	src->uncomposable.clear();
+	patchCache.clear();
+	compositeCache.clear();
+	QString location = src->store->location();
+	src->unavailableTiles.load(location+".missing");
+	if (!src->tileCache->openIndex(location+".idx",location))
+	{
+		cout<<"rebuilding cache index"<<endl;
+		src->tileCache->rescan();
+	}
+	cout<<"cache size "<<(float)src->tileCache->totalSize()/1024/1024<<" MB"<<endl;
+}
 
-	quint32 x = mapsize*(longitude + 180.0)/360.0;
-	
-	quint32 y = mapsize*(180.0 - latitude_m)/360.0;
-	
-	return longPoint(x,y);
+/**
+* Slot that gets called when a background rescan of the %tile store is done
+* Tiles that weren't known before may be on disk now, so everything is redrawn.
+*/
+void cacaMap::slotCacheIndexReset()
+{
+	//the other servers are redrawn when they are shown
+	tileSource *src = sourceOf(sender());
+	if (!src)
+	{
+		src = source;
+	}
+	if (!isShown(src))
+	{
+		return;
+	}
+	cout<<"cache size "<<(float)src->tileCache->totalSize()/1024/1024<<" MB"<<endl;
+	bufferDirty = true;
+	updateContent();
+	update();
 }
+
 /**
-* Converts  map pixels to geo coordinates in degrees
-* @param pixelcoord has the x and y px coordinates.
-* @param zoom  is the zoom level, ranges from 0(out) to 18(in).
-* @param tilesize the width/height in px of the square %tile (e.g 256).
-* @return a QPointF object containing the latitude and longitude of 
-* of the given location.
+* Slot that gets called when old tiles were deleted from the %tile store
+* Their decoded images and the patches cut from them are dropped too, so
+* what's drawn matches what's on disk and visible tiles are downloaded again.
 */
+void cacaMap::slotTilesEvicted(QList<tileKey> keys)
+{
+	if (keys.isEmpty())
+	{
+		return;
+	}
+	tileSource *src = sourceOf(sender());
+	if (!src)
+	{
+		src = source;
+	}
+	for (int i=0; i<keys.size(); i++)
+	{
+		src->memCache.remove(keys.at(i));
+	}
+	patchCache.clear();
+	if (isShown(src))
+	{
+		bufferDirty = true;
+		updateContent();
+		update();
+	}
+}
 
-QPointF myMercator::pixelToGeoCoord(longPoint const &pixelcoord, int zoom, int tilesize)
+/**
+* Uses another %tile store, e.g. a single .mbtiles file instead of the cache folder
+* The widget takes ownership of the store, the previous one is flushed and deleted.
+* @see tileStore::copyTiles() to move the cached tiles between stores
+*/
+void cacaMap::setTileStore(tileStore *newstore)
 {
-	long  x= pixelcoord.x;
-	long  y= pixelcoord.y;
-	
-	//height, width of the whole map,this is, all tiles for a given zoom level put together
-	quint32 mapsize =  (1<<zoom)*tilesize;
+	unavailableTiles->save();
+	loader->setStore(newstore);
+	tileCache->setStore(newstore);
+	store->flush();
+	delete store;
+	store = newstore;
+	source->store = newstore;
+	loadCache(source);
+	bufferDirty = true;
+	updateContent();
+	update();
+}
 
-	
-	qreal longitude = x*360.0/mapsize - 180.0;
-	
-	qreal latitude_m = 180.0 - y*360.0/mapsize;
-	qreal latitude = asin(tanh(latitude_m*M_PI/180.0))*180/M_PI;
-	
-	return QPointF(longitude,latitude);
+/**
+* Slot that gets called when the loader threads finish decoding a cached or downloaded %tile
+* The %tile is kept in memory and the part of the buffer it covers is redrawn.
+*/
+void cacaMap::slotTileLoaded(tileKey key, QImage image)
+{
+	tileSource *src = sourceOf(sender());
+	if (!src)
+	{
+		src = source;
+	}
+	if (!isShown(src))
+	{
+		return;
+	}
+	src->memCache.insert(key,QPixmap::fromImage(image));
+	QRegion area = tileRegion(key);
+	if (!area.isEmpty())
+	{
+		updateBuffer(area);
+		updateArea(area);
+	}
+	//blended in at fractional zoom levels
+	else if (fracZoom > 0 && key.zoom() == zoom + 1)
+	{
+		update();
+	}
 }
+
 /**
-* constructor
+* Slot that gets called when a cached %tile couldn't be read or decoded
+* It's dropped from the index and the store, so the next redraw downloads it
+* again instead of reading the broken file over and over.
 */
-cacaMap::cacaMap(QPointF startcoords,
-                 bool enable_download,
-                 QWidget* parent):QWidget(parent), tileSize(256), enable_downloading(enable_download)
+void cacaMap::slotTileUnreadable(tileKey key)
 {
-	cacheSize = 0;
-	maxZoom = 18;
-	minZoom = 0;
-	folder = QDir::currentPath();
-	loadCache();
-    geocoords = startcoords;
-	downloading = false;
-	zoom = 14;
-	manager = new QNetworkAccessManager(this);
-    manager->setStrictTransportSecurityEnabled(false);
-    manager->setRedirectPolicy(QNetworkRequest::SameOriginRedirectPolicy);
-    //manager->setRedirectPolicy();
-	loadingAnim.setFileName("loading.gif");
-	loadingAnim.setScaledSize(QSize(tileSize,tileSize));
-	loadingAnim.start();
-	notAvailableTile.load("notavailable.jpeg");
-	imgBuffer = new QPixmap(size());
-	buffzoomrate = 1.0;
+	tileSource *src = sourceOf(sender());
+	if (!src)
+	{
+		src = source;
+	}
+	src->tileCache->remove(key);
+	src->store->remove(key);
+	if (isShown(src))
+	{
+		QRegion area = tileRegion(key);
+		updateBuffer(area);
+		updateArea(area);
+	}
 }
 
 /**
-Sets the latitude and longitude to the coords in newcoords
-@param newcoords the new coordinates.
+* Slot that gets called when the loader threads finish building a %tile out of its children
+* The %tile is kept in memory, and in the %tile store if write back is on.
+* If it couldn't be composed it is downloaded on the next redraw.
 */
-void cacaMap::setGeoCoords(QPointF newcoords)
+void cacaMap::slotTileComposed(tileKey key, QImage image, QByteArray data)
 {
-	geocoords = newcoords;
+	tileSource *src = sourceOf(sender());
+	if (src && src != source)
+	{
+		return;
+	}
+	if (image.isNull())
+	{
+		uncomposable->insert(key);
+	}
+	else
+	{
+		//the composed tile is as fresh as its oldest child
+		if (!data.isEmpty() && !tileCache->contains(key) && store->write(key,data))
+		{
+			tileFreshness fresh;
+			fresh.fetched = QDateTime::currentMSecsSinceEpoch()/1000;
+			fresh.expires = fresh.fetched + FRESHNESS_DEFAULT;
+			for (int i=0; i<4; i++)
+			{
+				tileFreshness childfresh;
+				if (tileCache->freshness(key.child(i),childfresh))
+				{
+					fresh.expires = qMin(fresh.expires, childfresh.expires ? childfresh.expires
+						: childfresh.fetched + FRESHNESS_DEFAULT);
+				}
+			}
+			tileCache->insert(key,data.size(),fresh);
+			scheduleStoreFlush();
+		}
+		memCache->insert(key,QPixmap::fromImage(image));
+	}
+	QRegion area = tileRegion(key);
+	if (!area.isEmpty())
+	{
+		updateBuffer(area);
+		updateArea(area);
+	}
 }
+
 /**
-* zooms in one level
-* @return true if it zoomed succesfully, false otherwise (if maxZoom has been reached)
+* Slot that gets called everytime a %tile download finishes
+* Saves image to the %tile store and adds item to cache list
+* along with what the server said about reusing it
 */
-bool cacaMap::zoomIn()
+void cacaMap::slotDownloadReady(tileKey key, QByteArray data, tileFreshness fresh)
 {
-	if (zoom < maxZoom)
+	tileSource *src = sourceOf(sender());
+	if (!src)
 	{
-		zoom++;
-		downloadQueue.clear();
-		updateContent();
-		return true;
+		src = source;
 	}
-	return false;
+	//a revalidated tile changed, the patches and blends made from it are out of date
+	bool changed = src->tileCache->contains(key);
+	if (changed)
+	{
+		patchCache.clear();
+		compositeCache.clear();
+	}
+	if (src->store->write(key,data))
+	{
+		//add it to cache, this may start evicting old tiles in the background
+		src->tileCache->insert(key,data.size(),fresh);
+	}
+	//stores that batch their writes get the rest committed once downloads settle
+	scheduleStoreFlush();
+	//a tile of a server that's no longer shown is only stored,
+	//the old image must not be drawn when it's shown again
+	if (!isShown(src))
+	{
+		if (changed)
+		{
+			src->memCache.remove(key);
+		}
+		return;
+	}
+	//decoded on the loader threads, slotTileLoaded() draws it
+	src->loader->decode(key,data);
 }
+
 /**
-* zooms out one level
-* @return true if it zoomed succesfully, false otherwise (if minZoom has been reached)
+* Commits the writes the %tile store is still holding
 */
-bool cacaMap::zoomOut()
+void cacaMap::slotFlushStore()
 {
-	if (zoom > minZoom)
+	storeFlushPending = false;
+	for (int i=0; i<sources.size(); i++)
 	{
-		zoom--;
-		downloadQueue.clear();
-		updateContent();
-		return true;
+		if (sources.at(i))
+		{
+			sources.at(i)->store->flush();
+			sources.at(i)->unavailableTiles.save();
+		}
 	}
-	return false;
 }
 
 /**
-* zooms to a specific level
-* @return true if it is a valid level, false otherwise (if level is outside the valid range)
+* Commits the store's buffered writes and saves the missing tiles in a second,
+* so a burst of downloads ends up in a few commits
 */
-bool cacaMap::setZoom(int level)
+void cacaMap::scheduleStoreFlush()
 {
-	if (level>= minZoom && level <= maxZoom)
+	if (!storeFlushPending)
 	{
-		zoom = level;
-		downloadQueue.clear();
-		updateContent();
-		return true;
+		storeFlushPending = true;
+		QTimer::singleShot(1000, this, SLOT(slotFlushStore()));
+	}
+}
+
+/**
+* Slot that gets called when the server says a stale %tile didn't change
+* Only its freshness is updated, the cached image is neither rewritten nor decoded again.
+*/
+void cacaMap::slotTileNotModified(tileKey key, tileFreshness fresh)
+{
+	tileSource *src = sourceOf(sender());
+	(src ? src : source)->tileCache->refresh(key,fresh);
+}
+
+/**
+* Slot that gets called when a %tile couldn't be downloaded
+* Transient errors were already retried by the downloader, they are
+* queued again on the next redraw.
+*/
+void cacaMap::slotDownloadFailed(tileKey key, QNetworkReply::NetworkError error)
+{
+	//if content is not available we dont want to keep requesting it
+	if (error == QNetworkReply::ContentNotFoundError)
+	{
+		tileSource *src = sourceOf(sender());
+		if (!src)
+		{
+			src = source;
+		}
+		src->unavailableTiles.insert(key);
+		scheduleStoreFlush();
+		if (isShown(src))
+		{
+			QRegion area = tileRegion(key);
+			updateBuffer(area);
+			updateArea(area);
+		}
+	}
+}
+
+/**
+Widget resize event handler
+*/
+void cacaMap::resizeEvent(QResizeEvent* event)
+{
+	delete imgBuffer;
+	imgBuffer = new QPixmap(size());
+	bufferDirty = true;
+	updateContent();
+}
+
+/**
+* @return mapping from the buffer to the widget, a magnification around
+* the center for fractional zoom levels
+*/
+QTransform cacaMap::zoomTransform() const
+{
+	QTransform transform;
+	if (fracZoom > 0)
+	{
+		qreal scale = qPow(2,fracZoom);
+		transform.translate(width()/2.0,height()/2.0);
+		transform.scale(scale,scale);
+		transform.translate(-width()/2.0,-height()/2.0);
+	}
+	return transform;
+}
+
+/**
+* Draws the decoded tiles of the level above on top of the magnified buffer
+* They fade in as the zoom gets closer to that level, the ones that aren't
+* decoded yet are requested and the buffer shows through meanwhile.
+* @param p painter on the widget, transformed to buffer coordinates
+*/
+void cacaMap::blendNextLevel(QPainter &p)
+{
+	int next = zoom + 1;
+	if (next > servermgr.maxZoom())
+	{
+		return;
+	}
+	//visible part of the buffer, in map px of the level above
+	qreal scale = qPow(2,fracZoom);
+	qreal halfw = width()/2.0;
+	qreal halfh = height()/2.0;
+	qreal left = 2*(tilesToRender.originx + halfw - halfw/scale);
+	qreal right = 2*(tilesToRender.originx + halfw + halfw/scale);
+	qreal top = 2*(tilesToRender.originy + halfh - halfh/scale);
+	qreal bottom = 2*(tilesToRender.originy + halfh + halfh/scale);
+	qint64 numtiles = (qint64)1<<next;
+	qreal half = tileSize/2.0;
+	p.setOpacity(fracZoom);
+	for (qint64 j=qMax((qint64)0,(qint64)qFloor(top/tileSize)); j<=qMin(numtiles-1,(qint64)qFloor(bottom/tileSize)); j++)
+	{
+		for (qint64 i=qFloor(left/tileSize); i<=qFloor(right/tileSize); i++)
+		{
+			tileKey key(next,(quint32)(((i%numtiles)+numtiles)%numtiles),(quint32)j);
+			QPixmap image;
+			bool found = layers.isEmpty() ? memCache->find(key,image) : compositeCache.find(key,layerVersion,image);
+			if (found)
+			{
+				p.drawPixmap(QRectF(i*half - tilesToRender.originx, j*half - tilesToRender.originy, half, half),
+					image, QRectF(image.rect()));
+			}
+			else if (tileCache->touch(key))
+			{
+				loader->request(key);
+			}
+		}
+	}
+	p.setOpacity(1);
+}
+
+/**
+* Blits buffer to widget
+* At fractional zoom levels the painter magnifies the buffer as it's drawn,
+* no scaled copy of it is made.
+*/
+void cacaMap::renderMap(QPainter &p, const QRegion &area)
+{
+	if (fracZoom > 0)
+	{
+		p.save();
+		p.setRenderHint(QPainter::SmoothPixmapTransform);
+		p.setTransform(zoomTransform());
+		p.drawPixmap(0,0,*imgBuffer);
+		blendNextLevel(p);
+		p.restore();
+	}
+	else
+	{
+		//only the parts that need it
+		for (const QRect &r : area)
+		{
+			p.drawPixmap(r.topLeft(),*imgBuffer,r);
+		}
 	}
-	return false;
+	p.drawRect(0,0,width()-1, height()-1);
 }
-
 /**
-* @return current geocoords
+Paint even handler
+Only the region that needs it is repainted, e.g. where a %tile arrived.
 */
-QPointF cacaMap::getGeoCoords()
-{
-	return geocoords;
-}
-
-void cacaMap::setEnableDownloadTiles(bool enabled)
+void cacaMap::paintEvent(QPaintEvent *event)
 {
-    enable_downloading = enabled;
-    if (enable_downloading == false)
-    {
-        downloadQueue.clear();
-    }
-    //TODO: signal
+	QPainter p(this);
+	p.setClipRegion(event->region());
+	renderMap(p,event->region());
+	p.setTransform(zoomTransform());
+	for (int i=0; i<overlays.size(); i++)
+	{
+		overlays.at(i)->paint(p, tilesToRender, tileSize);
+	}
 }
 
-bool cacaMap::enabledDownloadTiles() const
-{
-    return enable_downloading;
-}
 /**
-*   @return current zoom level
+destructor
 */
-int cacaMap::getZoom()
+cacaMap::~cacaMap()
 {
-	return zoom;
-}	
-
+	for (int i=0; i<sources.size(); i++)
+	{
+		tileSource *src = sources.at(i);
+		if (!src)
+		{
+			continue;
+		}
+		//saving the cache index may still deliver results, the widget is gone by then
+		disconnect(src->tileCache, 0, this, 0);
+		delete src->tileCache;
+		delete src->loader;
+		delete src->downloader;
+		src->store->flush();
+		delete src->store;
+		src->unavailableTiles.save();
+		delete src;
+	}
+	delete imgBuffer;
+}
 /**
-*@param zoom zoom level
-*@param x tile x column
-*@return string with the path to the folder containing the tiles in 
-*for zoom level and x column
+Figures out which tiles are visible
+Based on the current size of the widget, the %tile size, current coordinates and zoom level
 */
-QString cacaMap::getTilePath(int zoom,qint32 x)
+void cacaMap::updateTilesToRender()
 {
-    return servermgr.tileCacheFolder()+servermgr.filePath(zoom,x);
+	tilesToRender = tileSet::cover(geocoords,zoom,size(),tileSize);
 }
-
 /**
-* @return image for temporarily replacing a tile that is downloading and currently unavailable
-* The 'patch' is a subsection of an available tile from a lower zoom level.
-* The algorithm tries to find a suitable tile starting from level zoom -1, until level 0.
-* The higher the zoom level difference the more pixelated the patch will be.
+* Draws a single %tile into the buffer, queueing it for download if it isn't cached
+* @param p painter on the image buffer
+* @param i tile column, can be outside [0,2^zoom] (horizontal wrapping)
+* @param j tile row
 */
-QPixmap cacaMap::getTilePatch(int zoom, quint32 x, quint32 y, int offx, int offy, int tsize)
+void cacaMap::drawTile(QPainter &p, qint32 i, qint32 j)
 {
-	//dont go beyond level 0 and 
-	//dont use patches smaller than 16 px. They are unintelligible anyways.
-	if (zoom>0 && tsize>=16*2)
+	//wrap around the tiles horizontally if i is outside [0,2^zoom]
+	qint32 numtiles = 1<<tilesToRender.zoom;
+	qint32 valx =((i<0)*numtiles + i%numtiles)%numtiles;
+	QPixmap image;
+	int posx = (i-tilesToRender.left)*tileSize - tilesToRender.offsetx;
+	int posy =  (j-tilesToRender.top)*tileSize - tilesToRender.offsety;
+	//dont try to render tiles with y coords outside range
+	//cause we cant do vertical wrapping!
+	if (j>=0 && j<numtiles)
 	{
-		int parentx, parenty, offsetx, offsety;
-		QString tileid;
-		QPixmap patch;
-		QString sz,sx,sy;
-		parentx = x/2;
-		parenty = y/2;
-		sz.setNum(zoom-1);
-		sx.setNum(parentx);
-		sy.setNum(parenty);
-		offsetx = offx/2 + (x%2)*tileSize/2;
-		offsety = offy/2 + (y%2)*tileSize/2;
-		tileid = sz+"."+sx+"."+sy;
-		if (tileCache.contains(tileid))
+		tileKey key(tilesToRender.zoom,valx,j);
+		//with layers, a tile that was fully blended before is drawn as it was
+		if (!layers.isEmpty() && compositeCache.find(key,layerVersion,image))
+		{
+			p.drawPixmap(posx,posy,image);
+			return;
+		}
+		bool complete = false;
+		//past the server's max zoom there's nothing to download, cached tiles are scaled up
+		if (tilesToRender.zoom > servermgr.maxZoom())
+		{
+			tileKey top = key;
+			while (top.zoom() > servermgr.maxZoom())
+			{
+				top = top.parent();
+			}
+			if (enable_downloading && !tileCache->contains(top) && !unavailableTiles->contains(top)
+				&& (!downloader->contains(top) || downloader->isPrefetch(top)))
+			{
+				downloader->enqueue(top,servermgr.getTileUrl(top));
+			}
+			image = getTilePatch(key);
+		}
+		else if (tileCache->touch(key))
 		{
-			//render the tile
-			QDir::setCurrent(folder);
-			QString path= getTilePath(zoom-1,parentx) ;
-			QString fileName = servermgr.fileName(parenty);
-			QDir::setCurrent(path);
-			QFile f(fileName);
-			if (f.open(QIODevice::ReadOnly))
+			//render the tile, or a patch while it's being decoded
+			complete = loadTile(key,image);
+			if (!complete)
+			{
+				image = getTilePatch(key);
+			}
+			//a stale tile is shown anyway while the server is asked if it changed
+			tileFreshness fresh;
+			if (enable_downloading && !downloader->contains(key) && tileCache->freshness(key,fresh)
+				&& fresh.isStale(QDateTime::currentMSecsSinceEpoch()/1000))
 			{
-				patch.loadFromData(f.readAll());
-				f.close();
-				return patch.copy(offsetx,offsety,tsize/2,tsize/2).scaledToHeight(tileSize);
+				downloader->revalidate(key,servermgr.getTileUrl(key),fresh);
 			}
-			else
+		}
+		//check if it's in the list of unavailable tiles
+		else if (unavailableTiles->contains(key))
+		{
+			image = notAvailableTile;
+		}
+		//build it out of its children if we have them all, e.g. after zooming out
+		else if (composeTile(key,image))
+		{
+			//nothing to download, the composed tile or a patch is drawn
+		}
+		//the tile is not cached so download it
+		else if (enable_downloading)
+		{
+			//check that the image hasnt been queued already, prefetches are moved up
+			if (!downloader->contains(key) || downloader->isPrefetch(key))
 			{
-				cout<<"no file found "<<path.toStdString()<<fileName.toStdString()<<endl;
+				//queue the image for download
+				downloader->enqueue(key,servermgr.getTileUrl(key));
 			}
+			//crop a tile from a lower zoom level and use it as a patch(a la google maps)
+			//while the tile is downloading	
+			image = getTilePatch(key);
 		}
-		else
+		if (!layers.isEmpty())
 		{
-			return getTilePatch(zoom-1,parentx,parenty,offsetx,offsety,tsize/2);
+			image = compositeTile(key,image,complete);
 		}
+		p.drawPixmap(posx,posy,image);
 	}
-	return loadingAnim.currentPixmap();
 }
 
-
-
 /**
-Starts downloading the next %tile in the queue
-@see cacaMap::downloadQueue
+* Blends the layers on top of a %tile of the base map
+* Layer tiles that aren't decoded yet are loaded or downloaded by their own source.
+* Once the base %tile and all the layer tiles are there the result is cached,
+* the next redraws draw it as a single pixmap.
+* @param key %tile
+* @param base image of the base map, may be a patch
+* @param complete the base image is the real %tile
+* @return the blended %tile
 */
-void cacaMap::downloadPicture()
+QPixmap cacaMap::compositeTile(const tileKey &key, const QPixmap &base, bool complete)
 {
-	//check if there isnt an active download already
-	if (!downloading)
+	QPixmap composite(tileSize,tileSize);
+	composite.fill(Qt::gray);
+	QPainter p(&composite);
+	p.drawPixmap(0,0,base);
+	for (int i=0; i<layers.size(); i++)
 	{
-		//there are items in the queue
-		if (downloadQueue.size())
+		tileSource *src = sources.at(layers.at(i).server);
+		//nothing to draw past the layer's max zoom
+		if (key.zoom() > src->layout.maxZoom())
+		{
+			continue;
+		}
+		QPixmap tile;
+		if (src->memCache.find(key,tile))
 		{
-			downloading = true;
-			QHash<QString,tile>::const_iterator i;
-			i = downloadQueue.constBegin();
-			tile nextItem = i.value();
-			QString surl = nextItem.url;
-			QNetworkRequest request;
-			request.setUrl(QUrl(surl));
-			QNetworkReply *reply = manager->get(request);
-            connect(reply, SIGNAL(errorOccurred(QNetworkReply::NetworkError)),this, SLOT(slotError(QNetworkReply::NetworkError)));
-			connect(manager, SIGNAL(finished(QNetworkReply*)),this, SLOT(slotDownloadReady(QNetworkReply*)));
-			connect(reply, SIGNAL(downloadProgress(qint64,qint64)),this, SLOT(slotDownloadProgress(qint64, qint64)));
+			p.setOpacity(layers.at(i).opacity);
+			p.drawPixmap(0,0,tile);
 		}
-		else
+		else if (src->tileCache->touch(key))
 		{
-		//	cout<<"no items in the queue"<<endl;
+			src->loader->request(key);
+			complete = false;
+		}
+		else if (!src->unavailableTiles.contains(key))
+		{
+			if (enable_downloading && !src->downloader->contains(key))
+			{
+				src->downloader->enqueue(key,src->layout.getTileUrl(key));
+			}
+			complete = false;
 		}
 	}
-	else
+	p.end();
+	if (complete)
 	{
-		cout<<"another download is already in progress... "<<endl;
-	}
-}
-/**
-Populates the cache list by checking the existing files on the cache folder
-*/
-void cacaMap::loadCache()
-{
-	cacheSize=0;
-	unavailableTiles.clear();
-	tileCache.clear();
-	QDir::setCurrent(folder);
-	QDir dir;
-    if (dir.cd(servermgr.tileCacheFolder()))
-    {
-        QStringList zoom = dir.entryList(QDir::Dirs | QDir::NoDotAndDotDot);
-        QString zoomLevel;
-        for(int i=0; i< zoom.size(); i++)
-        {
-            zoomLevel = zoom.at(i);
-            dir.cd(zoomLevel);
-            QStringList longitudes = dir.entryList(QDir::Dirs|QDir::NoDotAndDotDot);
-            QString lon;
-            for(int j=0; j< longitudes.size(); j++)
-            {
-                lon = longitudes.at(j);
-                dir.cd(lon);
-                QFileInfoList latitudes = dir.entryInfoList(QDir::Files|QDir::NoDotAndDotDot);
-                QString lat;
-                for(int k=0; k< latitudes.size(); k++)
-                {
-                    lat = latitudes.at(k).baseName();
-                    cacheSize+= latitudes.at(k).size();
-                    QString name = zoomLevel+"."+lon+"."+lat;
-                    tileCache.insert(name,1);
-                }
-                dir.cdUp();//go back to zoom level folder
-            }
-            dir.cdUp();//go back to tile folder
-        }
-		QDir::setCurrent(folder);
-		cout<<"cache size "<<(float)cacheSize/1024/1024<<" MB"<<endl;
+		compositeCache.insert(key,layerVersion,composite);
 	}
+	return composite;
 }
 
 /**
-Slot to keep track of download progress
+* Blits all visible tiles to the buffer
 */
-void cacaMap::slotDownloadProgress(qint64 _bytesReceived, qint64 _bytesTotal)
+void cacaMap::updateBuffer()
 {
+	updateBuffer(QRegion(imgBuffer->rect()));
+	bufferTiles = tilesToRender;
+	bufferDirty = false;
 }
 
 /**
-* Slot that gets called everytime a %tile download request finishes
-* Saves image file to HDD, takes out item from download queue, and  adds item to cache list
+* Blits the visible tiles that intersect a part of the buffer
+* Only the given area is repainted, the rest of the buffer is left untouched.
+* @param area buffer area to repaint, in widget coordinates
 */
-void cacaMap::slotDownloadReady(QNetworkReply * _reply)
+void cacaMap::updateBuffer(const QRegion &area)
 {
-	QNetworkReply::NetworkError error = _reply->error();
-	//get url of original request 
-	QNetworkRequest req = _reply->request();
-	QUrl url = req.url();
-	QString surl = url.toString();
-	bool found = false;
-	QHash<QString,tile>::const_iterator i;
-	i = downloadQueue.constBegin();
-	
-	for( i; i!=downloadQueue.constEnd();i++)
-	{
-		if (i.value().url == surl)
-		{
-			found = true;
-			break;
-		}
-	}
-
-	if (error == QNetworkReply::NoError)
+	QPainter p(imgBuffer);
+	for (const QRect &r : area)
 	{
-		qint64 bytes = _reply->bytesAvailable();
-
-		if (bytes)
+		p.setClipRect(r);
+		p.fillRect(r,Qt::gray);
+		//only the tiles that overlap the rect
+		qint32 left = tilesToRender.left + (r.left() + tilesToRender.offsetx)/tileSize;
+		qint32 right = tilesToRender.left + (r.right() + tilesToRender.offsetx)/tileSize;
+		qint32 top = tilesToRender.top + (r.top() + tilesToRender.offsety)/tileSize;
+		qint32 bottom = tilesToRender.top + (r.bottom() + tilesToRender.offsety)/tileSize;
+		for (qint32 i= qMax(left,tilesToRender.left);i<= qMin(right,tilesToRender.right); i++)
 		{
-			//get url of original request 
-			QNetworkRequest req = _reply->request();
-			QUrl url = req.url();
-			QString surl = url.toString();
-			cacheSize+=bytes;
-			//get image data
-			QByteArray data = _reply->readAll();		
-			if (found)
-			{
-				tile nextItem = i.value();
-				QString kk = i.key();
-				QString zdir = QString().setNum(nextItem.zoom);
-				QString xdir = QString().setNum(nextItem.x);
-				QString tilefile = servermgr.fileName(nextItem.y);
-
-				QDir::setCurrent(folder);
-				QDir dir;
-				if (!dir.exists(servermgr.tileCacheFolder()))
-				{
-					dir.mkdir(servermgr.tileCacheFolder());
-				}
-				dir.cd(servermgr.tileCacheFolder());
-
-				if(!dir.exists(zdir))
-				{
-					dir.mkdir(zdir);	
-				}
-				dir.cd(zdir);
-				if(!dir.exists(xdir))
-				{
-					dir.mkdir(xdir);	
-				}
-				dir.cd(xdir);
-				
-				QDir::setCurrent(dir.path());
-				QFile f(tilefile);
-				f.open(QIODevice::WriteOnly);
-				quint64 byteswritten = f.write(data);
-				if (byteswritten <= 0)
-				{
-					cout<<"error writing to file "<<f.fileName().toStdString()<<endl;
-				}
-				f.close();
-				//remove item from download queue
-				downloadQueue.remove(i.key());
-				
-				//add it to cache
-				tileCache.insert(kk,1);
-				//update with new tile
-				updateBuffer();
-				update();
-			}
-			else
+			for (qint32 j=qMax(top,tilesToRender.top) ; j<= qMin(bottom,tilesToRender.bottom); j++)
 			{
-				cout<<"downloaded tile "<<surl.toStdString()<<" was not in Download queue. Data ignored"<<endl;
+				drawTile(p,i,j);
 			}
-			downloading = false;
-			downloadPicture();
-			
-		}
-		else
-		{
-			//cout<<"no data"<<endl;
 		}
-		update();
 	}
-	else
+	if (enable_downloading)
 	{
-        qDebug() <<"network error: ("<<error<<") "<<_reply->errorString();
-		
-		if(found)
+		QList<tileSource*> shown = shownSources();
+		for (int i=0; i<shown.size(); i++)
 		{
-			//if content is not available we dont want to keep requesting it
-			if (error == QNetworkReply::ContentNotFoundError)
-			{
-				unavailableTiles.insert(i.key(),1);
-			}
-			//remove the item from queue and try again
-			downloadQueue.remove(i.key());
-			downloading = false;
-			downloadPicture();
+			shown.at(i)->downloader->startDownloads();
 		}
 	}
-	_reply->deleteLater();
 }
+
 /**
-Slot that gets called when theres is an network error
+* Moves the buffer contents to follow a pan and repaints only the uncovered strips
+* @param dx horizontal displacement of the map in px
+* @param dy vertical displacement of the map in px
 */
-void cacaMap::slotError(QNetworkReply::NetworkError _code)
+void cacaMap::scrollBuffer(int dx, int dy)
 {
-	cout<<"some error "<<_code<<endl;
+	QRegion exposed;
+	imgBuffer->scroll(dx,dy,imgBuffer->rect(),&exposed);
+	updateBuffer(exposed);
+	bufferTiles = tilesToRender;
 }
+
 /**
-Widget resize event handler
+* @return part of the buffer covered by a %tile
+* Tiles from lower zoom levels cover the area of all their descendants,
+* since they are used as patches for them.
+* @param key %tile
 */
-void cacaMap::resizeEvent(QResizeEvent* event)
+QRegion cacaMap::tileRegion(const tileKey &key)
 {
-	delete imgBuffer;
-	imgBuffer = new QPixmap(size());
-	updateContent();
+	QRegion area;
+	quint32 x = key.x();
+	quint32 y = key.y();
+	int dz = tilesToRender.zoom - key.zoom();
+	if (dz < 0)
+	{
+		return area;
+	}
+	qint32 numtiles = 1<<tilesToRender.zoom;
+	qint32 top = qMax(tilesToRender.top,(qint32)(y<<dz));
+	qint32 bottom = qMin(tilesToRender.bottom,(qint32)(((y+1)<<dz)-1));
+	if (top > bottom)
+	{
+		return area;
+	}
+	int posy = (top-tilesToRender.top)*tileSize - tilesToRender.offsety;
+	int h = (bottom-top+1)*tileSize;
+	for (qint32 i= tilesToRender.left;i<= tilesToRender.right; i++)
+	{
+		qint32 valx =((i<0)*numtiles + i%numtiles)%numtiles;
+		if ((quint32)(valx>>dz) == x)
+		{
+			int posx = (i-tilesToRender.left)*tileSize - tilesToRender.offsetx;
+			area += QRect(posx,posy,tileSize,h);
+		}
+	}
+	return area & imgBuffer->rect();
 }
 
 /**
-* Blits buffer to widget
+* calls the following two functions
+* The download queue is reprioritized for the new viewport.
+* The buffer is fully redrawn only after a zoom change or a resize,
+* a pan just scrolls it and draws the newly exposed tiles.
+* @see cacaMap::updateTilesToRender
+* @see cacaMap::updateBuffer
 */
-void cacaMap::renderMap(QPainter &p)
+void cacaMap::updateContent()
 {
-	//QRect dest(QPoint(0,0), size());
-	if (buffzoomrate<1.0)
+	contentPending = false;
+	frameClock.restart();
+	updateTilesToRender();
+	//stale downloads are dropped before the new tiles get queued, for the
+	//base map and each layer. when overzoomed the tiles downloaded are those
+	//of the server's max zoom
+	QList<tileSource*> shown = shownSources();
+	for (int i=0; i<shown.size(); i++)
+	{
+		int dlzoom = qMin(zoom, shown.at(i)->layout.maxZoom());
+		qreal dltile = (qreal)(tileSize<<(zoom - dlzoom));
+		shown.at(i)->downloader->setViewport(dlzoom,
+			QPointF((tilesToRender.originx + width()/2)/dltile,
+			        (tilesToRender.originy + height()/2)/dltile),
+			QSizeF(width()/2.0/dltile, height()/2.0/dltile));
+	}
+	qint64 dx = tilesToRender.originx - bufferTiles.originx;
+	qint64 dy = tilesToRender.originy - bufferTiles.originy;
+	if (bufferDirty || tilesToRender.zoom != bufferTiles.zoom
+		|| qAbs(dx) >= width() || qAbs(dy) >= height())
+	{
+		updateBuffer();
+	}
+	else if (dx || dy)
 	{
-		int ox = width()*(1-buffzoomrate)/2;
-		int oy = height()*(1-buffzoomrate)/2;
-		QRect src(QPoint(ox,oy),size()*buffzoomrate); 
-		
-		tmpbuff= imgBuffer->copy(src).scaled(size(),Qt::KeepAspectRatio);
+		scrollBuffer((int)-dx,(int)-dy);
+	}
+	updatePanVelocity(dx,dy);
+	prefetchTiles();
+}
 
-		p.drawPixmap(0,0,tmpbuff);
-		//p.drawPixmap(dest, *imgBuffer,src);//this is shorter but slower
+/**
+* Updates the buffer for the new coords or zoom at most once per frame
+* The first change after a quiet frame is drawn right away, the ones that
+* follow within the same frame are collapsed into one update when it ends.
+* Use it instead of updateContent() for high rate input, e.g. mouse moves.
+*/
+void cacaMap::scheduleContentUpdate()
+{
+	contentPending = true;
+	if (frameTimer.isActive())
+	{
+		return;
+	}
+	qint64 elapsed = frameClock.elapsed();
+	if (elapsed >= FRAME_INTERVAL)
+	{
+		slotFrame();
 	}
 	else
 	{
-		p.drawPixmap(0,0,*imgBuffer);
+		frameTimer.start(FRAME_INTERVAL - elapsed);
 	}
 }
+
 /**
-Paint even handler
+* Runs the buffer update left pending by scheduleContentUpdate()
 */
-void cacaMap::paintEvent(QPaintEvent *event)
+void cacaMap::slotFrame()
 {
-	QPainter p(this);
-	renderMap(p);
+	if (contentPending)
+	{
+		updateContent();
+		update();
+	}
 }
 
 /**
-destructor
+* Schedules a repaint of the part of the widget showing an area of the buffer
+* While the buffer is shown scaled, during a zoom animation, everything is repainted.
+* @param area buffer area that changed
 */
-cacaMap::~cacaMap()
+void cacaMap::updateArea(const QRegion &area)
 {
-	delete manager;
-	delete imgBuffer;
+	if (fracZoom > 0)
+	{
+		update();
+	}
+	else if (!area.isEmpty())
+	{
+		update(area);
+	}
 }
+
 /**
-Figures out which tiles are visible
-Based on the current size of the widget, the %tile size, current coordinates and zoom level
+* Keeps track of how fast the map is being panned
+* @param dx horizontal displacement of the map since the last update in px
+* @param dy vertical displacement of the map since the last update in px
 */
-void cacaMap::updateTilesToRender()
+void cacaMap::updatePanVelocity(qint64 dx, qint64 dy)
 {
-	longPoint pixelCoords = myMercator::geoCoordToPixel(geocoords,zoom,tileSize); 
-
-	//central tile coords
-	qint32 xtile = pixelCoords.x/tileSize;
-	qint32 ytile = pixelCoords.y/tileSize;
-	//offset of central tile respect to the center of the widget
-	int offsetx = pixelCoords.x % tileSize;
-	int offsety = pixelCoords.y % tileSize;
-
-	//num columns of tiles that fit left of the central tile
-	float tilesleft = (float)(this->width()/2 - offsetx)/tileSize;
-	
-	//how many pixels overflow from the leftmost  tiles
-	//second %tileSize is to take into account negative tilesLeft
-	int globaloffsetx = (tileSize - (this->width()/2 - offsetx) % tileSize)%tileSize;
-
-	//num rows of tiles that fit above the central tile
-	float tilesup = (float)(this->height()/2 - offsety)/tileSize;
-
-	//how many pixels overflow from top tiles
-	int globaloffsety = (tileSize - (this->height()/2 - offsety) % tileSize)%tileSize;
+	if (tilesToRender.zoom != bufferTiles.zoom)
+	{
+		panVelocity = QPointF();
+		panClock.restart();
+		return;
+	}
+	if (!dx && !dy)
+	{
+		return;
+	}
+	qint64 ms = panClock.restart();
+	//a pan that starts after a pause starts from rest
+	if (ms <= 0 || ms > 500)
+	{
+		panVelocity = QPointF();
+		return;
+	}
+	panVelocity = 0.5*panVelocity + 0.5*QPointF(dx*1000.0/ms, dy*1000.0/ms);
+}
 
-	//num columns of tiles that fit right of central tile
-	float tilesright = (float)(this->width()/2 + offsetx - tileSize)/tileSize;
-	//num rows of tiles that fit under central tile
-	float tilesbottom = (float)(this->height()/2 + offsety - tileSize)/tileSize;
+/**
+* Queues the tiles that are likely to be shown next
+* A ring of prefetchRing tiles around the visible ones, stretched in the
+* direction of the pan, and the tiles of the next zoom level around the
+* center and around the point being zoomed in on.
+* The previous prefetches that weren't started are dropped.
+*/
+void cacaMap::prefetchTiles()
+{
+	downloader->clearPrefetch();
+	//overzoomed levels are never downloaded
+	if (!enable_downloading || prefetchRing < 0 || zoom > servermgr.maxZoom())
+	{
+		return;
+	}
+	qint32 aheadx = qBound(-PREFETCH_MAX_AHEAD, qRound(panVelocity.x()*PREFETCH_LOOKAHEAD/tileSize), PREFETCH_MAX_AHEAD);
+	qint32 aheady = qBound(-PREFETCH_MAX_AHEAD, qRound(panVelocity.y()*PREFETCH_LOOKAHEAD/tileSize), PREFETCH_MAX_AHEAD);
+	prefetchArea(zoom,
+		tilesToRender.left - prefetchRing + qMin(0,aheadx),
+		tilesToRender.top - prefetchRing + qMin(0,aheady),
+		tilesToRender.right + prefetchRing + qMax(0,aheadx),
+		tilesToRender.bottom + prefetchRing + qMax(0,aheady));
 
-	tilesToRender.left = xtile - ceil(tilesleft);
-	tilesToRender.right = xtile + ceil(tilesright);
-	tilesToRender.top =ytile - ceil(tilesup);
-	tilesToRender.bottom = ytile + ceil(tilesbottom);
-	tilesToRender.offsetx = globaloffsetx;
-	tilesToRender.offsety = globaloffsety;
-	tilesToRender.zoom = zoom;
+	if (zoom < qMin(maxZoom, servermgr.maxZoom()))
+	{
+		//what would be visible after zooming in
+		qint64 halfw = width()/2;
+		qint64 halfh = height()/2;
+		qint64 cx = 2*(tilesToRender.originx + halfw);
+		qint64 cy = 2*(tilesToRender.originy + halfh);
+		prefetchArea(zoom+1, (cx-halfw)/tileSize, (cy-halfh)/tileSize, (cx+halfw)/tileSize, (cy+halfh)/tileSize);
+		if (hasZoomTarget)
+		{
+			longPoint target = myMercator::geoCoordToPixel(zoomTarget,zoom+1,tileSize);
+			prefetchArea(zoom+1, ((qint64)target.x-halfw)/tileSize, ((qint64)target.y-halfh)/tileSize,
+			             ((qint64)target.x+halfw)/tileSize, ((qint64)target.y+halfh)/tileSize);
+		}
+	}
+	downloader->startDownloads();
 }
+
 /**
-* Blits visible tiles buffer
+* Prefetches the tiles of a range that aren't visible, cached or known to be missing
+* @param z zoom level
+* @param left leftmost column, can be outside [0,2^zoom] (horizontal wrapping)
+* @param top topmost row
+* @param right rightmost column
+* @param bottom bottommost row
 */
-void cacaMap::updateBuffer()
+void cacaMap::prefetchArea(int z, qint64 left, qint64 top, qint64 right, qint64 bottom)
 {
-	QPainter p(imgBuffer);
-	imgBuffer->fill(Qt::gray);
-	for (qint32 i= tilesToRender.left;i<= tilesToRender.right; i++)
+	qint64 numtiles = (qint64)1<<z;
+	top = qMax(top,(qint64)0);
+	bottom = qMin(bottom,numtiles-1);
+	//never more than the whole row
+	right = qMin(right,left+numtiles-1);
+	for (qint64 i=left; i<=right; i++)
 	{
-		for (qint32 j=tilesToRender.top ; j<= tilesToRender.bottom; j++)
+		quint32 valx = (quint32)(((i%numtiles)+numtiles)%numtiles);
+		for (qint64 j=top; j<=bottom; j++)
 		{
-			QString x;
-			QString y;
-			//wrap around the tiles horizontally if i is outside [0,2^zoom]
-			qint32 numtiles = 1<<tilesToRender.zoom;
-			qint32 valx =((i<0)*numtiles + i%numtiles)%numtiles;
-			x.setNum(valx);
-			QPixmap image;
-            int posx = (i-tilesToRender.left)*tileSize - tilesToRender.offsetx;
-			int posy =  (j-tilesToRender.top)*tileSize - tilesToRender.offsety;
-			//dont try to render tiles with y coords outside range
-			//cause we cant do vertical wrapping!
-			if (j>=0 && j<numtiles)
+			if (z == tilesToRender.zoom && i>=tilesToRender.left && i<=tilesToRender.right
+				&& j>=tilesToRender.top && j<=tilesToRender.bottom)
 			{
-				QString tileid = QString().setNum(tilesToRender.zoom) +"."+x+"."+QString().setNum(j);
-				if (tileCache.contains(tileid))
-				{
-					//render the tile
-					QDir::setCurrent(folder);
-					//check path format (windows?)
-					QString path= getTilePath(tilesToRender.zoom,valx) ;
-					QString fileName = servermgr.fileName(j);
-					QDir::setCurrent(path);
-					QFile f(fileName);
-					if (f.open(QIODevice::ReadOnly))
-					{
-						image.loadFromData(f.readAll());
-						f.close();
-					}
-					else
-					{
-						cout<<"no file found "<<path.toStdString()<<fileName.toStdString()<<endl;
-					}
-				}
-				//check if it's in the list of unavailable tiles
-				else if (unavailableTiles.contains(tileid))
-				{
-					image = notAvailableTile;
-				}
-				//the tile is not cached so download it
-                else if (enable_downloading)
-				{
-					//check that the image hasnt been queued already
-					if (!downloadQueue.contains(tileid))
-					{
-						tile t;
-						t.zoom = tilesToRender.zoom;
-						t.x = valx;
-						t.y = j;
-						t.url = servermgr.getTileUrl(tilesToRender.zoom,valx,j);
-						//queue the image for download
-						downloadQueue.insert(tileid,t);
-					}
-					//crop a tile from a lower zoom level and use it as a patch(a la google maps)
-					//while the tile is downloading	
-                    image = getTilePatch(tilesToRender.zoom,valx,j,0,0,tileSize);
-				}
-				p.drawPixmap(posx,posy,image);
+				continue;
+			}
+			tileKey key(z,valx,(quint32)j);
+			if (!tileCache->contains(key) && !unavailableTiles->contains(key) && !downloader->contains(key))
+			{
+				downloader->prefetch(key,servermgr.getTileUrl(key));
 			}
 		}
 	}
-	p.drawRect(0,0,width()-1, height()-1);
-    if (enable_downloading && !downloading)
-	{
-		downloadPicture();
-	}
 }
+
 /**
-* calls the following two functions
-* @see cacaMap::updateTilesToRender
-* @see cacaMap::updateBuffer
+* Called when the range of zoom levels changes, e.g. when overzoom is enabled
 */
-void cacaMap::updateContent()
+void cacaMap::zoomRangeChanged()
 {
-	updateTilesToRender();
-	updateBuffer();
+}
+
+/**
+* Prefetches the next zoom level around a point, e.g. where the user double clicked
+* The target is kept until the zoom level changes.
+* @param geocoord longitude and latitude in degrees
+*/
+void cacaMap::prefetchZoomTarget(QPointF geocoord)
+{
+	zoomTarget = geocoord;
+	hasZoomTarget = true;
+	prefetchTiles();
 }
 
 cacaMapMouse::cacaMapMouse(QPointF startcoords,
@@ -711,8 +1723,10 @@ cacaMapMouse::cacaMapMouse(QPointF startcoords,
 {
     cout<<"derived constructor"<<endl;
     timer = new QTimer(this);
-    mindistance = 0.025f;
-    animrate = 0.5f;
+    animTarget = zoom;
+    mindistance = 0.02f;
+    animrate = 0.2f;
+    grabGesture(Qt::PinchGesture);
 
     hlayout = new QHBoxLayout;
 
@@ -753,46 +1767,131 @@ void cacaMapMouse::mouseMoveEvent(QMouseEvent* e)
 {
     QPoint delta = e->pos()- mouseAnchor;
     mouseAnchor = e->pos();
-    longPoint p = myMercator::geoCoordToPixel(geocoords,zoom,tileSize);
-
-    p.x-= delta.x();
-    p.y-= delta.y();
-    geocoords = myMercator::pixelToGeoCoord(p,zoom,tileSize);
-    updateContent();
-    update();
+    //the buffer is magnified at fractional zoom levels
+    QPointF p = myMercator::geoCoordToPixelF(geocoords,zoom,tileSize);
+    p -= QPointF(delta)/qPow(2,fracZoom);
+    geocoords = myMercator::pixelToGeoCoordF(p,zoom,tileSize);
+    //mice and touchscreens may report several moves per frame
+    scheduleContentUpdate();
 }
 
 void cacaMapMouse::mouseDoubleClickEvent(QMouseEvent* e)
 {
     //do the zoom-in animation magic
-    if (e->button() == Qt::LeftButton)
+    if (e->button() == Qt::LeftButton && !timer->isActive() && zoom < maxZoom)
     {
-        QPoint deltapx = e->pos() - QPoint(width()/2,height()/2);
-        longPoint currpospx = myMercator::geoCoordToPixel(geocoords,zoom,tileSize);
-        longPoint newpospx;
-        newpospx.x = currpospx.x + deltapx.x();
-        newpospx.y = currpospx.y + deltapx.y();
-        destination = myMercator::pixelToGeoCoord(newpospx,zoom,tileSize);
+        QPointF deltapx = QPointF(e->pos() - QPoint(width()/2,height()/2))/qPow(2,fracZoom);
+        QPointF currpospx = myMercator::geoCoordToPixelF(geocoords,zoom,tileSize);
+        destination = myMercator::pixelToGeoCoordF(currpospx + deltapx,zoom,tileSize);
+        animTarget = zoom + 1;
+        prefetchZoomTarget(destination);
         connect(timer,SIGNAL(timeout()),this,SLOT(zoomAnim()));
-        timer->start(40);
+        //one step per display frame
+        timer->start(FRAME_INTERVAL);
     }
     //do a simple zoom out for now
     else if (e->button() == Qt::RightButton)
     {
         zoomOut();
-        slider->setSliderPosition(zoom);
+        syncSlider();
         update();
     }
 }
 
+/**
+* Keeps the slider range in sync with the zoom levels
+*/
+void cacaMapMouse::zoomRangeChanged()
+{
+    slider->setMaximum(maxZoom);
+}
+
+/**
+* Zooms in or out by a number of levels, keeping a point of the view in place
+* @param levels zoom levels, may be fractional, negative zooms out
+* @param pos point of the widget that stays in place, e.g. under the mouse
+*/
+void cacaMapMouse::zoomAround(qreal levels, QPointF pos)
+{
+    if (timer->isActive())
+    {
+        timer->stop();
+        disconnect(timer,SIGNAL(timeout()),this,SLOT(zoomAnim()));
+    }
+    qreal before = getZoomF();
+    qreal after = qBound((qreal)minZoom, before + levels, (qreal)maxZoom);
+    //in px of a map of size 1, where the point is before and after zooming
+    QPointF offset = pos - QPointF(width()/2.0,height()/2.0);
+    QPointF center = myMercator::geoCoordToPixelF(geocoords,0,1);
+    QPointF anchor = center + offset/(tileSize*qPow(2,before));
+    geocoords = myMercator::pixelToGeoCoordF(anchor - offset/(tileSize*qPow(2,after)),0,1);
+    if (!setZoomF(after))
+    {
+        return;
+    }
+    syncSlider();
+    scheduleContentUpdate();
+    update();
+}
+
+/**
+* Wheels zoom in steps of WHEEL_ZOOM_STEP levels a notch, touchpads that
+* report smaller deltas zoom continuously
+*/
+void cacaMapMouse::wheelEvent(QWheelEvent* e)
+{
+    qreal levels = e->angleDelta().y()/120.0*WHEEL_ZOOM_STEP;
+    if (levels != 0)
+    {
+        zoomAround(levels, e->position());
+    }
+    e->accept();
+}
+
+/**
+* Handles pinch gestures, the map zooms around the center of the pinch
+*/
+bool cacaMapMouse::event(QEvent* e)
+{
+    if (e->type() == QEvent::Gesture)
+    {
+        QGestureEvent *gesture = static_cast<QGestureEvent*>(e);
+        QPinchGesture *pinch = static_cast<QPinchGesture*>(gesture->gesture(Qt::PinchGesture));
+        if (pinch)
+        {
+            if ((pinch->changeFlags() & QPinchGesture::ScaleFactorChanged) && pinch->scaleFactor() > 0)
+            {
+                zoomAround(std::log2(pinch->scaleFactor()), mapFromGlobal(pinch->centerPoint().toPoint()));
+            }
+            gesture->accept(pinch);
+            return true;
+        }
+    }
+    return cacaMap::event(e);
+}
+
+/**
+* Moves the slider to the zoom level without zooming again
+*/
+void cacaMapMouse::syncSlider()
+{
+    slider->blockSignals(true);
+    slider->setSliderPosition(zoom);
+    slider->blockSignals(false);
+}
+
+/**
+* One frame of the double click animation, the zoom and the coords move
+* part of the way to the target every frame
+*/
 void cacaMapMouse::zoomAnim()
 {
-    float delta = buffzoomrate - 0.5;
+    qreal delta = animTarget - getZoomF();
     if (delta > mindistance)
     {
         QPointF deltaSpace = destination - geocoords;
         geocoords+=animrate*deltaSpace;
-        buffzoomrate-= delta*animrate;
+        setZoomF(getZoomF() + delta*animrate);
         updateContent();
     }
     //you are already there
@@ -801,9 +1900,8 @@ void cacaMapMouse::zoomAnim()
         timer->stop();
         disconnect(timer,SIGNAL(timeout()),this,SLOT(zoomAnim()));
         geocoords = destination;
-        buffzoomrate = 1.0;
-        zoomIn();
-        slider->setSliderPosition(zoom);
+        setZoom(qRound(animTarget));
+        syncSlider();
     }
     update();
 }
@@ -816,5 +1914,8 @@ void cacaMapMouse::paintEvent(QPaintEvent *e)
 {
     cacaMap::paintEvent(e);
     QPainter painter(this);
-    painter.fillRect(QRect(0,0,width(),height()), QBrush(QColor(128, 128, 128, 128)));
+    for (const QRect &r : e->region())
+    {
+        painter.fillRect(r, QBrush(QColor(128, 128, 128, 128)));
+    }
 }
@@ -6,83 +6,74 @@
 #include <QWidget>
 #include <QSlider>
 #include <QHBoxLayout>
-
-
-struct tileserver
-{
-    QString name;/**<name of the tile server*/
-    QString url;/**< url template for accessing tiles*/
-    QString folder;/**< name of folder where tiles will be stored*/
-    QString path;/**< path where tiles will be stored*/
-    QString tile;/**< tile file*/
-};
-
-class servermanager
-{
-public:
-    servermanager();
-    QString getTileUrl(int,quint32,quint32);
-    QString tileCacheFolder();
-    //returns the filename of the file as it should be stored in HD
-    QString fileName(quint32);
-    QString serverName();
-    QString filePath(int, quint32);
-
-private:
-    tileserver servermain;
-};
+#include <QGesture>
+#include "tilekey.h"
+#include "mercator.h"
+#include "servermanager.h"
+#include "tilestore.h"
+#include "tilecache.h"
+#include "tilediskcache.h"
+#include "missingtiles.h"
+#include "tileloader.h"
+#include "tiledownloader.h"
+#include "mapoverlay.h"
 
 /**
-* The quint32 version of QPoint
+* how far ahead of a pan tiles are prefetched, in seconds at the current pan speed
 */
-
-struct longPoint
-{
-	quint32 x;/**< x coord. */
-	quint32 y;/**< y coord.*/
-	longPoint(quint32,quint32);
-	longPoint();
-};
-
+#define PREFETCH_LOOKAHEAD 1.0
 /**
-Helper struct that handles coordinate transformations
+* maximum number of tiles the prefetch ring is stretched in the pan direction
 */
-struct myMercator
-{
-	static longPoint geoCoordToPixel(QPointF const &,int , int);
-	static QPointF pixelToGeoCoord(longPoint const &, int, int);
-};
+#define PREFETCH_MAX_AHEAD 4
 /**
-* Struct to define a range of consecutive tiles
-* It's used to identify which tiles are visible and need to be rendered/downlaoded
-* @see cacaMap::updateTilesToRender()
+* smallest piece of an ancestor, in px, scaled up as a patch for a missing %tile
 */
-struct tileSet
-{
-	int zoom;/**< zoom level.*/
-	qint32 top;/**< topmost row.*/
-	qint32 bottom;/**< bottommost row.*/
-	qint32 left;/**< leftmostcolumn. */
-	qint32 right;/**< rightmost column. */
-	int offsetx;/**< horizontal offset needed to align the tiles in the wiget.*/
-	int offsety;/**< vertical offset needed to align the tiles in the widget.*/
-};
+#define PATCH_MIN_SIZE 16
+/**
+* maximum number of zoom levels past the server's max zoom
+*/
+#define OVERZOOM_MAX_LEVELS 6
+/**
+* tile sources that aren't shown keep 1/N of the memory budget for decoded tiles
+*/
+#define IDLE_SOURCE_MEMCACHE_SHARE 4
+/**
+* minimum time in ms between two buffer updates while panning, about one display frame
+*/
+#define FRAME_INTERVAL 16
+/**
+* zoom levels a notch of the mouse wheel zooms in or out
+*/
+#define WHEEL_ZOOM_STEP 0.5
 
 /**
-* Used to represent a specific %tile
-* @see cacaMap::tileCache
+* What the widget keeps for each tile source
+* Switching back to a source finds its index, decoded tiles and missing
+* tiles as they were left, nothing is reloaded.
 */
-struct tile
+struct tileSource
 {
-	int zoom;/**< zoom level.*/
-	qint32 x;/**< colum number.*/
-	qint32 y;/**< row number.*/
-	QString  url;/**<used to identify the %tile when it finishes downloading.*/
+	servermanager layout;/**< the tile server, its urls and file paths. */
+	tileStore *store;/**< where the downloaded tiles are kept. */
+	tileDiskCache *tileCache;/**< index of the tiles in the store. */
+	tileLoader *loader;/**< reads and decodes tiles of the store. */
+	tileDownloader *downloader;/**< download queue of the source. */
+	missingTiles unavailableTiles;/**< tiles the server doesn't have. */
+	tileMemCache memCache;/**< decoded tiles. */
+	QSet<tileKey> uncomposable;/**< tiles that couldn't be built out of their children. */
 };
+
 /**
-* maximum space allowed for caching tiles
+* A tile server drawn on top of the base map
 */
-#define CACHE_MAX 100*1024*1024 //100 MB
+struct mapLayer
+{
+	int server;/**< index of the tile server. */
+	qreal opacity;/**< 0 is transparent, 1 opaque. */
+};
+
+
 /**
 Main map widget
 */
@@ -104,30 +95,118 @@ public:
 	bool zoomOut();
 	bool setZoom(int level);
     int getZoom();
+    bool setZoomF(qreal level);
+    qreal getZoomF();
 
     void setGeoCoords(QPointF);
     QPointF getGeoCoords();
 
     void setEnableDownloadTiles(bool enabled);
     bool enabledDownloadTiles() const;
+
+    void setMaxConcurrentDownloads(int downloads, int perhost=-1);
+    int maxConcurrentDownloads() const;
+    int maxDownloadsPerHost() const;
+
+    void setDiskCacheSize(qint64 bytes);
+    qint64 diskCacheSize() const;
+    qint64 diskCacheUsed() const;
+
+    void setTileStore(tileStore *newstore);
+
+    void setMemCacheSize(int bytes);
+    int memCacheSize() const;
+    quint64 memCacheHits() const;
+    quint64 memCacheMisses() const;
+
+    void setMissingTileTtl(qint64 secs);
+    qint64 missingTileTtl() const;
+
+    void setPrefetch(int margin, int downloads=2);
+    int prefetchMargin() const;
+    int maxPrefetchDownloads() const;
+
+    void setOverzoom(int levels);
+    int overzoom() const;
+
+    void setPatchCacheSize(int bytes);
+    int patchCacheSize() const;
+
+    void setComposeFromChildren(bool enabled, bool writeback=false);
+    bool composeFromChildren() const;
+    bool composeWriteBack() const;
+
+    QStringList tileServers() const;
+    int tileServer() const;
+    bool setTileServer(int index);
+
+    int addLayer(int server, qreal opacity=1.0);
+    bool removeLayer(int layer);
+    void clearLayers();
+    int layerCount() const;
+    bool setLayerOpacity(int layer, qreal opacity);
+    qreal layerOpacity(int layer) const;
+
+    void addOverlay(QSharedPointer<mapOverlay> overlay);
+    bool removeOverlay(QSharedPointer<mapOverlay> overlay);
+    tileSet getVisibleTiles() const;
+    int getTileSize() const;
+    QPoint mapToView(QPoint pos) const;
+    QList<int> featuresAt(const featureOverlay &overlay, QPoint pos, int tolerance=3) const;
 private:
-	QNetworkAccessManager *manager;/**< manages http requests. */
+	QVector<tileSource*> sources;/**< state of each tile server that was shown, 0 for the others. */
+	tileSource *source;/**< state of the current tile server, the members below point into it. */
+	tileDownloader *downloader;/**< downloads the queued tiles. */
 	tileSet tilesToRender;/**< range of visible tiles. */
-	QHash<QString,int> tileCache;/**< list of cached tiles (in HDD). */
-	QHash<QString,tile> downloadQueue;/**< list of tiles waiting to be downloaded. */
-	QHash<QString,int> unavailableTiles;/**< list of tiles that were not found on the server.*/
+	tileStore *store;/**< where downloaded tiles are kept. */
+	bool storeFlushPending;/**< a commit of the store's buffered writes is scheduled. */
+	tileDiskCache *tileCache;/**< list of cached tiles (in HDD). */
+	missingTiles *unavailableTiles;/**< list of tiles that were not found on the server.*/
+	tileMemCache *memCache;/**< decoded tiles kept in RAM. */
+	int memCacheBudget;/**< memory budget for the decoded tiles of the current source. */
+	derivedTileCache patchCache;/**< patches cut from ancestors of missing tiles. */
+	QList<mapLayer> layers;/**< drawn on top of the base map, bottom first. */
+	int layerVersion;/**< bumped every time the layers change. */
+	QList<QSharedPointer<mapOverlay> > overlays;/**< drawn on top of the map and its layers, in order. */
+	derivedTileCache compositeCache;/**< complete tiles blended with the layers, tagged with layerVersion. */
+	int overzoomLevels;/**< zoom levels past the server's max zoom that are upscaled. */
+	bool composeChildren;/**< missing tiles are built out of their four cached children. */
+	bool composeStore;/**< tiles built out of their children are written to the %tile store. */
+	QSet<tileKey> *uncomposable;/**< tiles that couldn't be built out of their children. */
+	tileLoader *loader;/**< reads and decodes cached tiles off the GUI thread. */
     bool enable_downloading;
-    bool downloading;/**< flag that indicates if there is a download going on. */
 	QString folder;/**< root application folder. */
 	QMovie loadingAnim;/**< to show a 'loading' animation for yet unavailable tiles. */
 	QPixmap notAvailableTile;
 	servermanager servermgr;	
+	int prefetchRing;/**< tiles around the viewport queued ahead of time, -1 disables prefetching. */
+	QPointF panVelocity;/**< recent pan speed in map px per second, smoothed. */
+	QElapsedTimer panClock;/**< time since the last pan. */
+	QPointF zoomTarget;/**< geo coords the map is about to zoom in on. */
+	bool hasZoomTarget;/**< zoomTarget is set. */
+	QTimer frameTimer;/**< runs the pending buffer update at the next frame. */
+	QElapsedTimer frameClock;/**< time since the last buffer update. */
+	bool contentPending;/**< the map moved and the buffer hasn't been updated yet. */
 
-	void renderMap(QPainter &);
-	void downloadPicture();
-	void loadCache();
-	QString getTilePath(int, qint32);
-	QPixmap getTilePatch(int,quint32,quint32,int,int,int);
+	void renderMap(QPainter &, const QRegion &);
+	QTransform zoomTransform() const;
+	void blendNextLevel(QPainter &);
+	tileSource *createSource(int);
+	void useSource(tileSource *);
+	tileSource *sourceOf(QObject *) const;
+	bool isLayer(tileSource *) const;
+	bool isShown(tileSource *) const;
+	QList<tileSource*> shownSources() const;
+	void layersChanged();
+	QPixmap compositeTile(const tileKey &, const QPixmap &, bool);
+	void loadCache(tileSource *);
+	void scheduleStoreFlush();
+	void prefetchTiles();
+	void prefetchArea(int, qint64, qint64, qint64, qint64);
+	void updatePanVelocity(qint64, qint64);
+	bool loadTile(const tileKey &, QPixmap &);
+	QPixmap getTilePatch(const tileKey &);
+	bool composeTile(const tileKey &, QPixmap &);
 
 protected:
 	int zoom;/**< Map zoom level. */
@@ -135,24 +214,38 @@ protected:
 	int maxZoom;/**< Maximum zoom level (closest).*/
 
     const int tileSize; /**< size in px of the square %tile. */
-	quint32 cacheSize;/**< current %tile cache size in bytes. */
 	//check QtMobility QGeoCoordinate
 	QPointF geocoords; /**< current longitude and latitude. */
 	QPixmap* imgBuffer;
-	QPixmap tmpbuff;
-	float buffzoomrate;
+	qreal fracZoom;/**< fractional part of the zoom, the buffer is drawn at zoom and magnified 2^fracZoom times. */
 
-	bool bufferDirty; /**< image buffer needs to be updated. */	
+	bool bufferDirty; /**< image buffer needs a full redraw. */	
+	tileSet bufferTiles;/**< tiles the image buffer was last drawn with. */
 	void resizeEvent(QResizeEvent*);
 	void paintEvent(QPaintEvent *);
 	void updateTilesToRender();
 	void updateBuffer();
+	void updateBuffer(const QRegion &);
+	void scrollBuffer(int, int);
+	void drawTile(QPainter &, qint32, qint32);
+	QRegion tileRegion(const tileKey &);
 	void updateContent();
+	void scheduleContentUpdate();
+	void updateArea(const QRegion &);
+	void prefetchZoomTarget(QPointF);
+	virtual void zoomRangeChanged();
 
 protected slots:
-	void slotDownloadProgress(qint64, qint64);
-	void slotDownloadReady(QNetworkReply *);
-	void slotError(QNetworkReply::NetworkError);
+	void slotDownloadReady(tileKey, QByteArray, tileFreshness);
+	void slotTileNotModified(tileKey, tileFreshness);
+	void slotDownloadFailed(tileKey, QNetworkReply::NetworkError);
+	void slotTileLoaded(tileKey, QImage);
+	void slotTileUnreadable(tileKey);
+	void slotTileComposed(tileKey, QImage, QByteArray);
+	void slotFlushStore();
+	void slotCacheIndexReset();
+	void slotTilesEvicted(QList<tileKey>);
+	void slotFrame();
 };
 
 
@@ -170,6 +263,11 @@ protected:
     void mousePressEvent(QMouseEvent*);
     void mouseMoveEvent(QMouseEvent*);
     void mouseDoubleClickEvent(QMouseEvent*);
+    void wheelEvent(QWheelEvent*);
+    bool event(QEvent*);
+    void zoomRangeChanged();
+    void zoomAround(qreal, QPointF);
+    void syncSlider();
 private:
     QPoint mouseAnchor;/**< used to keep track of the last mouse click location.*/
     QTimer * timer;
@@ -177,6 +275,7 @@ private:
 
     QSlider * slider;
     QPointF destination; /**< used for dblclick+zoom animations */
+    qreal animTarget;/**< zoom level the double click animation ends at. */
     float mindistance;/**< used to identify the end of the animation*/
     float animrate;
 protected slots:
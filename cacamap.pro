@@ -1,6 +1,6 @@
 
 TEMPLATE = app	
-QT+=gui widgets network
+QT+=gui widgets network sql
 # Input
-HEADERS += cacamap.h
-SOURCES += cacamap.cpp main.cpp
+HEADERS += cacamap.h tilekey.h tiletemplate.h tilefreshness.h mercator.h servermanager.h tilestore.h tilecache.h tileloader.h tiledownloader.h tilediskcache.h missingtiles.h tileseeder.h staticmap.h mapoverlay.h trackoverlay.h
+SOURCES += cacamap.cpp mercator.cpp tiletemplate.cpp servermanager.cpp tilestore.cpp tilecache.cpp tileloader.cpp tiledownloader.cpp tilediskcache.cpp missingtiles.cpp tileseeder.cpp staticmap.cpp mapoverlay.cpp trackoverlay.cpp main.cpp
@@ -0,0 +1,7 @@
+TEMPLATE = app
+TARGET = cacaseed
+CONFIG += console
+QT+=network sql
+# Input
+HEADERS += tilekey.h tilefreshness.h mercator.h tiletemplate.h servermanager.h tilestore.h tiledownloader.h tilediskcache.h tileseeder.h
+SOURCES += mercator.cpp tiletemplate.cpp servermanager.cpp tilestore.cpp tiledownloader.cpp tilediskcache.cpp tileseeder.cpp seedmain.cpp
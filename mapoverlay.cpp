@@ -0,0 +1,499 @@
+#include "mapoverlay.h"
+#include <QtMath>
+#include <algorithm>
+
+mapOverlay::~mapOverlay()
+{
+}
+
+/**
+* constructor, the index is empty
+*/
+featureIndex::featureIndex()
+{
+    root = newNode(QRectF(0,0,1,1), 0);
+}
+
+featureIndex::~featureIndex()
+{
+    destroy(root);
+}
+
+featureIndex::node *featureIndex::newNode(const QRectF &area, int depth)
+{
+    node *n = new node;
+    n->area = area;
+    n->depth = depth;
+    for (int i=0; i<4; i++)
+    {
+        n->children[i] = 0;
+    }
+    return n;
+}
+
+void featureIndex::destroy(node *n)
+{
+    for (int i=0; i<4; i++)
+    {
+        if (n->children[i])
+        {
+            destroy(n->children[i]);
+        }
+    }
+    delete n;
+}
+
+/**
+* @return true if two rectangles touch. Unlike QRectF::intersects() it works
+* for empty rectangles, which is what points are.
+*/
+bool featureIndex::overlaps(const QRectF &a, const QRectF &b)
+{
+    return a.left() <= b.right() && b.left() <= a.right()
+        && a.top() <= b.bottom() && b.top() <= a.bottom();
+}
+
+/**
+* @return quadrant of a node that fully contains a rectangle, -1 if none does
+* 0 top left, 1 top right, 2 bottom left, 3 bottom right
+*/
+int featureIndex::quadrantOf(const node *n, const QRectF &r)
+{
+    if (r.left() < n->area.left() || r.right() > n->area.right()
+        || r.top() < n->area.top() || r.bottom() > n->area.bottom())
+    {
+        return -1;
+    }
+    QPointF mid = n->area.center();
+    int quadrant = 0;
+    if (r.left() >= mid.x())
+    {
+        quadrant |= 1;
+    }
+    else if (r.right() >= mid.x())
+    {
+        return -1;
+    }
+    if (r.top() >= mid.y())
+    {
+        quadrant |= 2;
+    }
+    else if (r.bottom() >= mid.y())
+    {
+        return -1;
+    }
+    return quadrant;
+}
+
+/**
+* Adds an item
+* @param id item id
+* @param bounds bounding box of the item in world coordinates
+*/
+void featureIndex::insert(int id, const QRectF &bounds)
+{
+    insert(root, id, bounds);
+}
+
+void featureIndex::insert(node *n, int id, const QRectF &bounds)
+{
+    while (n->children[0])
+    {
+        int q = quadrantOf(n, bounds);
+        if (q < 0)
+        {
+            break;
+        }
+        n = n->children[q];
+    }
+    n->ids.append(id);
+    n->bounds.append(bounds);
+    if (!n->children[0] && n->ids.size() > INDEX_NODE_CAPACITY && n->depth < INDEX_MAX_DEPTH)
+    {
+        split(n);
+    }
+}
+
+/**
+* Turns a leaf into four quadrants and moves down the items that fit in one
+*/
+void featureIndex::split(node *n)
+{
+    qreal w = n->area.width()/2;
+    qreal h = n->area.height()/2;
+    for (int i=0; i<4; i++)
+    {
+        n->children[i] = newNode(QRectF(n->area.left() + (i & 1)*w, n->area.top() + (i>>1)*h, w, h), n->depth+1);
+    }
+    for (int i=n->ids.size()-1; i>=0; i--)
+    {
+        int q = quadrantOf(n, n->bounds.at(i));
+        if (q >= 0)
+        {
+            insert(n->children[q], n->ids.at(i), n->bounds.at(i));
+            n->ids.remove(i);
+            n->bounds.remove(i);
+        }
+    }
+}
+
+/**
+* Removes an item
+* @param id item id
+* @param bounds the bounding box it was inserted with
+* @return false if it wasn't there
+*/
+bool featureIndex::remove(int id, const QRectF &bounds)
+{
+    node *n = root;
+    while (n)
+    {
+        int i = n->ids.indexOf(id);
+        if (i >= 0)
+        {
+            n->ids.remove(i);
+            n->bounds.remove(i);
+            return true;
+        }
+        int q = n->children[0] ? quadrantOf(n, bounds) : -1;
+        n = q < 0 ? 0 : n->children[q];
+    }
+    return false;
+}
+
+void featureIndex::clear()
+{
+    destroy(root);
+    root = newNode(QRectF(0,0,1,1), 0);
+}
+
+/**
+* Finds the items that touch an area
+* @param area in world coordinates
+* @param ids receives the ids, in no particular order
+*/
+void featureIndex::query(const QRectF &area, QVector<int> &ids) const
+{
+    query(root, area, ids);
+}
+
+void featureIndex::query(const node *n, const QRectF &area, QVector<int> &ids)
+{
+    //the root also keeps what sticks out of the world
+    if (n != 0 && n->depth > 0 && !overlaps(n->area, area))
+    {
+        return;
+    }
+    for (int i=0; i<n->ids.size(); i++)
+    {
+        if (overlaps(n->bounds.at(i), area))
+        {
+            ids.append(n->ids.at(i));
+        }
+    }
+    for (int i=0; i<4; i++)
+    {
+        if (n->children[i])
+        {
+            query(n->children[i], area, ids);
+        }
+    }
+}
+
+/**
+* constructor, black outline, red fill, 5 px markers
+*/
+featureStyle::featureStyle(): pen(Qt::black), brush(Qt::red), radius(5)
+{
+}
+
+/**
+* constructor, the overlay is empty
+*/
+featureOverlay::featureOverlay()
+{
+    nextId = 1;
+    pxMargin = 0;
+}
+
+/**
+* Projects geo coordinates to world coordinates, where the whole map is [0,1]x[0,1]
+* @param geocoords longitudes and latitudes in degrees
+*/
+QPolygonF featureOverlay::toWorld(const QPolygonF &geocoords)
+{
+    int n = geocoords.size();
+    QVector<qreal> x(n), y(n);
+    for (int i=0; i<n; i++)
+    {
+        x[i] = geocoords.at(i).x();
+        y[i] = geocoords.at(i).y();
+    }
+    myMercator::geoCoordsToPixels(x.constData(), y.constData(), x.data(), y.data(), n, 0, 1);
+    QPolygonF world(n);
+    for (int i=0; i<n; i++)
+    {
+        world[i] = QPointF(x.at(i), y.at(i));
+    }
+    return world;
+}
+
+int featureOverlay::add(mapFeature::featureType type, const QPolygonF &geocoords, const featureStyle &style)
+{
+    QWriteLocker locker(&lock);
+    mapFeature f;
+    f.type = type;
+    f.points = toWorld(geocoords);
+    f.bounds = f.points.boundingRect();
+    f.style = style;
+    int reach = qCeil(style.pen.widthF()/2) + 1;
+    if (type == mapFeature::MARKER)
+    {
+        reach += style.icon.isNull() ? style.radius : qMax(style.icon.width(), style.icon.height())/2;
+    }
+    pxMargin = qMax(pxMargin, reach);
+    int id = nextId++;
+    features.insert(id, f);
+    index.insert(id, f.bounds);
+    return id;
+}
+
+/**
+* Adds a marker
+* @param geocoord longitude and latitude in degrees
+* @param style brush, outline and radius of the circle, or an icon
+* @return id of the marker
+*/
+int featureOverlay::addMarker(QPointF geocoord, const featureStyle &style)
+{
+    return add(mapFeature::MARKER, QPolygonF() << geocoord, style);
+}
+
+/**
+* Adds a line, e.g. a track
+* @param geocoords longitudes and latitudes in degrees
+* @param style pen of the line
+* @return id of the line
+*/
+int featureOverlay::addPolyline(const QPolygonF &geocoords, const featureStyle &style)
+{
+    return add(mapFeature::POLYLINE, geocoords, style);
+}
+
+/**
+* Adds a filled polygon, e.g. an area
+* @param geocoords longitudes and latitudes in degrees
+* @param style outline and fill
+* @return id of the polygon
+*/
+int featureOverlay::addPolygon(const QPolygonF &geocoords, const featureStyle &style)
+{
+    return add(mapFeature::POLYGON, geocoords, style);
+}
+
+/**
+* Moves a marker, e.g. a vehicle that reported its position
+* @return false if there's no such marker
+*/
+bool featureOverlay::moveMarker(int id, QPointF geocoord)
+{
+    QWriteLocker locker(&lock);
+    QHash<int,mapFeature>::iterator i = features.find(id);
+    if (i == features.end() || i->type != mapFeature::MARKER)
+    {
+        return false;
+    }
+    index.remove(id, i->bounds);
+    i->points = toWorld(QPolygonF() << geocoord);
+    i->bounds = i->points.boundingRect();
+    index.insert(id, i->bounds);
+    return true;
+}
+
+/**
+* @return false if there's no such feature
+*/
+bool featureOverlay::remove(int id)
+{
+    QWriteLocker locker(&lock);
+    QHash<int,mapFeature>::iterator i = features.find(id);
+    if (i == features.end())
+    {
+        return false;
+    }
+    index.remove(id, i->bounds);
+    features.erase(i);
+    return true;
+}
+
+void featureOverlay::clear()
+{
+    QWriteLocker locker(&lock);
+    features.clear();
+    index.clear();
+    pxMargin = 0;
+}
+
+int featureOverlay::count() const
+{
+    QReadLocker locker(&lock);
+    return features.size();
+}
+
+/**
+* Draws one feature
+* @param p painter
+* @param f feature
+* @param mapsize size of the whole map in px
+* @param dx horizontal offset of the world in the view, in px
+* @param dy vertical offset of the world in the view, in px
+*/
+void featureOverlay::draw(QPainter &p, const mapFeature &f, qreal mapsize, qreal dx, qreal dy)
+{
+    QPolygonF screen(f.points.size());
+    for (int i=0; i<f.points.size(); i++)
+    {
+        screen[i] = QPointF(f.points.at(i).x()*mapsize + dx, f.points.at(i).y()*mapsize + dy);
+    }
+    p.setPen(f.style.pen);
+    switch (f.type)
+    {
+    case mapFeature::MARKER:
+        if (!f.style.icon.isNull())
+        {
+            p.drawImage(screen.at(0) - QPointF(f.style.icon.width()/2, f.style.icon.height()/2), f.style.icon);
+        }
+        else
+        {
+            p.setBrush(f.style.brush);
+            p.drawEllipse(screen.at(0), f.style.radius, f.style.radius);
+        }
+        break;
+    case mapFeature::POLYLINE:
+        p.setBrush(Qt::NoBrush);
+        p.drawPolyline(screen);
+        break;
+    case mapFeature::POLYGON:
+        p.setBrush(f.style.brush);
+        p.drawPolygon(screen);
+        break;
+    }
+}
+
+/**
+* Draws the features that intersect the visible tiles
+* Where the view wraps around horizontally every copy of the world is drawn.
+*/
+void featureOverlay::paint(QPainter &p, const tileSet &view, int tilesize) const
+{
+    QReadLocker locker(&lock);
+    qreal mapsize = myMercator::mapSize(view.zoom, tilesize);
+    qreal margin = pxMargin/mapsize;
+    qreal tile = tilesize/mapsize;
+    QRectF area(view.left*tile - margin, view.top*tile - margin,
+                (view.right - view.left + 1)*tile + 2*margin, (view.bottom - view.top + 1)*tile + 2*margin);
+    p.save();
+    p.setRenderHint(QPainter::Antialiasing);
+    QVector<int> ids;
+    for (qint64 k=qFloor(area.left()); k<=qFloor(area.right()); k++)
+    {
+        ids.clear();
+        index.query(area.translated(-k, 0), ids);
+        //the order they were added in
+        std::sort(ids.begin(), ids.end());
+        for (int i=0; i<ids.size(); i++)
+        {
+            draw(p, features.value(ids.at(i)), mapsize, k*mapsize - view.originx, -view.originy);
+        }
+    }
+    p.restore();
+}
+
+/**
+* @return distance in px from a point to a segment
+*/
+static qreal segmentDistance(QPointF p, QPointF a, QPointF b)
+{
+    QPointF ab = b - a;
+    qreal len = QPointF::dotProduct(ab, ab);
+    qreal t = len > 0 ? qBound((qreal)0, QPointF::dotProduct(p - a, ab)/len, (qreal)1) : 0;
+    QPointF d = p - (a + t*ab);
+    return qSqrt(QPointF::dotProduct(d, d));
+}
+
+/**
+* @return true if a point, in map px, is on a feature
+*/
+bool featureOverlay::hit(const mapFeature &f, QPointF pos, qreal mapsize, int tolerance)
+{
+    QPolygonF px(f.points.size());
+    for (int i=0; i<f.points.size(); i++)
+    {
+        px[i] = f.points.at(i)*mapsize;
+    }
+    qreal reach = tolerance + f.style.pen.widthF()/2;
+    switch (f.type)
+    {
+    case mapFeature::MARKER:
+        if (!f.style.icon.isNull())
+        {
+            QRectF r(0, 0, f.style.icon.width(), f.style.icon.height());
+            r.moveCenter(px.at(0));
+            return r.adjusted(-tolerance, -tolerance, tolerance, tolerance).contains(pos);
+        }
+        return segmentDistance(pos, px.at(0), px.at(0)) <= f.style.radius + reach;
+    case mapFeature::POLYGON:
+        if (px.containsPoint(pos, Qt::OddEvenFill))
+        {
+            return true;
+        }
+        if (px.size() > 1 && segmentDistance(pos, px.last(), px.first()) <= reach)
+        {
+            return true;
+        }
+        //test the edges
+        Q_FALLTHROUGH();
+    case mapFeature::POLYLINE:
+        for (int i=1; i<px.size(); i++)
+        {
+            if (segmentDistance(pos, px.at(i-1), px.at(i)) <= reach)
+            {
+                return true;
+            }
+        }
+        break;
+    }
+    return false;
+}
+
+/**
+* Finds the features under a point of the view, e.g. where the user clicked
+* @see cacaMap::featuresAt() to look up a point of the map widget
+* @param view the visible tiles, e.g. cacaMap::getVisibleTiles()
+* @param pos point in the view in px, e.g. cacaMap::mapToView()
+* @param tilesize the width/height in px of the square %tile (e.g 256)
+* @param tolerance how far off the point can be, in px
+* @return ids of the features, the topmost one first
+*/
+QList<int> featureOverlay::featuresAt(const tileSet &view, QPoint pos, int tilesize, int tolerance) const
+{
+    QReadLocker locker(&lock);
+    qreal mapsize = myMercator::mapSize(view.zoom, tilesize);
+    qreal x = (view.originx + pos.x())/mapsize;
+    qreal y = (view.originy + pos.y())/mapsize;
+    //back into the world if the view wrapped around
+    x -= qFloor(x);
+    qreal reach = (pxMargin + tolerance)/mapsize;
+    QVector<int> ids;
+    index.query(QRectF(x - reach, y - reach, 2*reach, 2*reach), ids);
+    std::sort(ids.begin(), ids.end());
+    QList<int> found;
+    for (int i=ids.size()-1; i>=0; i--)
+    {
+        if (hit(features.value(ids.at(i)), QPointF(x*mapsize, y*mapsize), mapsize, tolerance))
+        {
+            found.append(ids.at(i));
+        }
+    }
+    return found;
+}
@@ -0,0 +1,138 @@
+#ifndef MAPOVERLAY_H
+#define MAPOVERLAY_H
+
+#include <QPainter>
+#include <QPolygonF>
+#include <QRectF>
+#include <QVector>
+#include <QHash>
+#include <QList>
+#include <QPen>
+#include <QBrush>
+#include <QImage>
+#include <QReadWriteLock>
+#include "mercator.h"
+
+/**
+* a quadtree node holding more items than this is split
+*/
+#define INDEX_NODE_CAPACITY 16
+/**
+* quadtree nodes are not split past this depth
+*/
+#define INDEX_MAX_DEPTH 24
+
+/**
+* Something drawn on top of a map, e.g. markers or a track
+* paint() may be called from the static render threads, it must not touch widgets.
+* @see tileSet::pixel() to place geo coordinates
+*/
+class mapOverlay
+{
+public:
+    virtual ~mapOverlay();
+    virtual void paint(QPainter &, const tileSet &, int) const = 0;
+};
+
+/**
+* Quadtree of rectangles in world coordinates, the whole map being [0,1]x[0,1]
+* Each item sits in the smallest node that fully contains it, so lookups only
+* visit the nodes that intersect the area asked for.
+*/
+class featureIndex
+{
+public:
+    featureIndex();
+    ~featureIndex();
+
+    void insert(int, const QRectF &);
+    bool remove(int, const QRectF &);
+    void clear();
+    void query(const QRectF &, QVector<int> &) const;
+
+    static bool overlaps(const QRectF &, const QRectF &);
+
+private:
+    Q_DISABLE_COPY(featureIndex)
+
+    struct node
+    {
+        QRectF area;/**< part of the world the node covers. */
+        int depth;/**< 0 for the root. */
+        QVector<int> ids;/**< items kept in this node. */
+        QVector<QRectF> bounds;/**< bounds of each item, same order as ids. */
+        node *children[4];/**< quadrants, all 0 for a leaf. */
+    };
+    node *root;/**< covers the whole world. */
+
+    static node *newNode(const QRectF &, int);
+    static void destroy(node *);
+    static int quadrantOf(const node *, const QRectF &);
+    static void split(node *);
+    static void insert(node *, int, const QRectF &);
+    static void query(const node *, const QRectF &, QVector<int> &);
+};
+
+/**
+* How a feature is drawn
+*/
+struct featureStyle
+{
+    QPen pen;/**< outline of markers and polygons, the line of polylines. */
+    QBrush brush;/**< fill of markers and polygons. */
+    int radius;/**< radius of markers in px. */
+    QImage icon;/**< drawn centered on markers instead of a circle, if set. A QImage so static renders can draw it off the GUI thread. */
+
+    featureStyle();
+};
+
+/**
+* A marker, polyline or polygon, kept in world coordinates
+*/
+struct mapFeature
+{
+    enum featureType {MARKER, POLYLINE, POLYGON};
+    featureType type;/**< what is drawn. */
+    QPolygonF points;/**< world coordinates, a single point for markers. */
+    QRectF bounds;/**< bounding box of the points in world coordinates. */
+    featureStyle style;/**< how it's drawn. */
+};
+
+/**
+* Markers, polylines and polygons drawn on top of the map
+* Features are projected once when added and kept in a quadtree, each frame
+* only the ones that intersect the visible tiles are looked at. Features are
+* drawn in the order they were added.
+* @see cacaMap::addOverlay()
+*/
+class featureOverlay : public mapOverlay
+{
+public:
+    featureOverlay();
+
+    int addMarker(QPointF, const featureStyle &style = featureStyle());
+    int addPolyline(const QPolygonF &, const featureStyle &style = featureStyle());
+    int addPolygon(const QPolygonF &, const featureStyle &style = featureStyle());
+    bool moveMarker(int, QPointF);
+    bool remove(int);
+    void clear();
+    int count() const;
+
+    void paint(QPainter &, const tileSet &, int) const;
+    QList<int> featuresAt(const tileSet &, QPoint, int, int tolerance = 3) const;
+
+    static QPolygonF toWorld(const QPolygonF &);
+
+private:
+    QHash<int,mapFeature> features;/**< all features by id. */
+    featureIndex index;/**< bounds of the features. */
+    int nextId;/**< id of the next feature. */
+    int pxMargin;/**< px features reach out of their bounds, for markers and wide pens. */
+    mutable QReadWriteLock lock;/**< static renders may paint from other threads. */
+
+    int add(mapFeature::featureType, const QPolygonF &, const featureStyle &);
+    static bool hit(const mapFeature &, QPointF, qreal, int);
+    static void draw(QPainter &, const mapFeature &, qreal, qreal, qreal);
+};
+
+#endif
@@ -0,0 +1,205 @@
+#include "mercator.h"
+#include <QtMath>
+
+/**
+* constructor
+*/
+longPoint::longPoint(qint64 _x, qint64 _y)
+{
+	x = _x;
+	y = _y;
+}
+/**
+*empty constructor
+*/
+
+longPoint::longPoint()
+{
+	x = 0;
+	y = 0;
+}
+
+/**
+* @return height, width of the whole map in px, this is, all tiles for a given zoom level put together
+* @param zoom zoom level
+* @param tilesize the width/height in px of the square %tile (e.g 256).
+*/
+qreal myMercator::mapSize(int zoom, int tilesize)
+{
+	return (qreal)((qint64)tilesize<<zoom);
+}
+
+/**
+* Converts a geo coordinate to map pixels
+* @param geocoord has the longitude and latitude in degrees.
+* @param zoom is the zoom level, ranges from cacaMap::minZoom (out) to maxZoom (in).
+* @param tilesize the width/height in px of the square %tile (e.g 256).
+* @return a longpoint struct containing the x and y px coordinates
+* in the map for the given geocoordinates and zoom level.
+*/
+longPoint myMercator::geoCoordToPixel(QPointF const &geocoord, int zoom, int tilesize)
+{
+	QPointF p = geoCoordToPixelF(geocoord,zoom,tilesize);
+	return longPoint((qint64)qFloor(p.x()),(qint64)qFloor(p.y()));
+}
+/**
+* Converts  map pixels to geo coordinates in degrees
+* @param pixelcoord has the x and y px coordinates.
+* @param zoom  is the zoom level, ranges from 0(out) to 18(in).
+* @param tilesize the width/height in px of the square %tile (e.g 256).
+* @return a QPointF object containing the latitude and longitude of 
+* of the given location.
+*/
+
+QPointF myMercator::pixelToGeoCoord(longPoint const &pixelcoord, int zoom, int tilesize)
+{
+	return pixelToGeoCoordF(QPointF(pixelcoord.x,pixelcoord.y),zoom,tilesize);
+}
+
+/**
+* Converts a geo coordinate to map pixels, without rounding
+* @param geocoord has the longitude and latitude in degrees.
+* @param zoom zoom level
+* @param tilesize the width/height in px of the square %tile (e.g 256).
+* @return x and y px coordinates in the map
+*/
+QPointF myMercator::geoCoordToPixelF(QPointF const &geocoord, int zoom, int tilesize)
+{
+	qreal x, y;
+	qreal lon = geocoord.x();
+	qreal lat = geocoord.y();
+	geoCoordsToPixels(&lon,&lat,&x,&y,1,zoom,tilesize);
+	return QPointF(x,y);
+}
+
+/**
+* Converts map pixels to geo coordinates in degrees, without rounding
+* @param pixelcoord has the x and y px coordinates.
+* @param zoom zoom level
+* @param tilesize the width/height in px of the square %tile (e.g 256).
+* @return longitude and latitude
+*/
+QPointF myMercator::pixelToGeoCoordF(QPointF const &pixelcoord, int zoom, int tilesize)
+{
+	qreal lon, lat;
+	qreal x = pixelcoord.x();
+	qreal y = pixelcoord.y();
+	pixelsToGeoCoords(&x,&y,&lon,&lat,1,zoom,tilesize);
+	return QPointF(lon,lat);
+}
+
+/**
+* Converts many geo coordinates to map pixels at once
+* The scale factors are worked out once for the whole batch, each point
+* then costs one sin and one log.
+* @param lon longitudes in degrees
+* @param lat latitudes in degrees, clamped to +-MERCATOR_MAX_LATITUDE
+* @param x receives the x px coordinates, may be lon
+* @param y receives the y px coordinates, may be lat
+* @param count number of points
+* @param zoom zoom level
+* @param tilesize the width/height in px of the square %tile (e.g 256).
+*/
+void myMercator::geoCoordsToPixels(const qreal *lon, const qreal *lat, qreal *x, qreal *y,
+                                   int count, int zoom, int tilesize)
+{
+	const qreal mapsize = mapSize(zoom,tilesize);
+	const qreal xscale = mapsize/360.0;
+	const qreal yscale = mapsize/(4.0*M_PI);
+	const qreal torad = M_PI/180.0;
+	for (int i=0; i<count; i++)
+	{
+		//atanh(sin(lat)) = log((1+sin)/(1-sin))/2, which is infinite at the poles
+		qreal s = qSin(qBound((qreal)-MERCATOR_MAX_LATITUDE, lat[i], (qreal)MERCATOR_MAX_LATITUDE)*torad);
+		x[i] = (lon[i] + 180.0)*xscale;
+		y[i] = mapsize/2 - qLn((1.0 + s)/(1.0 - s))*yscale;
+	}
+}
+
+/**
+* Converts many map pixels to geo coordinates at once
+* @param x x px coordinates
+* @param y y px coordinates
+* @param lon receives the longitudes in degrees, may be x
+* @param lat receives the latitudes in degrees, may be y
+* @param count number of points
+* @param zoom zoom level
+* @param tilesize the width/height in px of the square %tile (e.g 256).
+* @see geoCoordsToPixels()
+*/
+void myMercator::pixelsToGeoCoords(const qreal *x, const qreal *y, qreal *lon, qreal *lat,
+                                   int count, int zoom, int tilesize)
+{
+	const qreal mapsize = mapSize(zoom,tilesize);
+	const qreal lonscale = 360.0/mapsize;
+	const qreal mscale = 2.0*M_PI/mapsize;
+	const qreal todeg = 180.0/M_PI;
+	for (int i=0; i<count; i++)
+	{
+		//asin(tanh(m)) = atan(sinh(m))
+		qreal m = (mapsize/2 - y[i])*mscale;
+		lon[i] = x[i]*lonscale - 180.0;
+		lat[i] = qAtan(std::sinh(m))*todeg;
+	}
+}
+
+/**
+* Figures out which tiles cover a view
+* @param geocoords longitude and latitude of the center of the view in degrees
+* @param zoom zoom level
+* @param size size of the view in px
+* @param tileSize the width/height in px of the square %tile (e.g 256)
+* @return range of tiles, columns can be outside [0,2^zoom] (horizontal wrapping)
+*/
+tileSet tileSet::cover(QPointF geocoords, int zoom, QSize size, int tileSize)
+{
+	tileSet t;
+	longPoint pixelCoords = myMercator::geoCoordToPixel(geocoords,zoom,tileSize); 
+
+	//central tile coords
+	qint32 xtile = pixelCoords.x/tileSize;
+	qint32 ytile = pixelCoords.y/tileSize;
+	//offset of central tile respect to the center of the widget
+	int offsetx = pixelCoords.x % tileSize;
+	int offsety = pixelCoords.y % tileSize;
+
+	//num columns of tiles that fit left of the central tile
+	float tilesleft = (float)(size.width()/2 - offsetx)/tileSize;
+	
+	//how many pixels overflow from the leftmost  tiles
+	//second %tileSize is to take into account negative tilesLeft
+	int globaloffsetx = (tileSize - (size.width()/2 - offsetx) % tileSize)%tileSize;
+
+	//num rows of tiles that fit above the central tile
+	float tilesup = (float)(size.height()/2 - offsety)/tileSize;
+
+	//how many pixels overflow from top tiles
+	int globaloffsety = (tileSize - (size.height()/2 - offsety) % tileSize)%tileSize;
+
+	//num columns of tiles that fit right of central tile
+	float tilesright = (float)(size.width()/2 + offsetx - tileSize)/tileSize;
+	//num rows of tiles that fit under central tile
+	float tilesbottom = (float)(size.height()/2 + offsety - tileSize)/tileSize;
+
+	t.left = xtile - ceil(tilesleft);
+	t.right = xtile + ceil(tilesright);
+	t.top =ytile - ceil(tilesup);
+	t.bottom = ytile + ceil(tilesbottom);
+	t.offsetx = globaloffsetx;
+	t.offsety = globaloffsety;
+	t.zoom = zoom;
+	t.originx = (qint64)pixelCoords.x - size.width()/2;
+	t.originy = (qint64)pixelCoords.y - size.height()/2;
+	return t;
+}
+
+/**
+* @return position of a geo coordinate in the view, in px from its top left corner
+* @param geocoord longitude and latitude in degrees
+* @param tileSize the width/height in px of the square %tile (e.g 256)
+*/
+QPoint tileSet::pixel(QPointF geocoord, int tileSize) const
+{
+	longPoint p = myMercator::geoCoordToPixel(geocoord,zoom,tileSize);
+	return QPoint((int)((qint64)p.x - originx), (int)((qint64)p.y - originy));
+}
@@ -0,0 +1,63 @@
+#ifndef MERCATOR_H
+#define MERCATOR_H
+
+#include <QtGlobal>
+#include <QPointF>
+#include <QPoint>
+#include <QSize>
+
+/**
+* latitudes are clamped to this, where the web mercator map is square
+*/
+#define MERCATOR_MAX_LATITUDE 85.0511287798
+
+/**
+* The qint64 version of QPoint
+* Map px coordinates need more than 32 bits past zoom 23.
+*/
+
+struct longPoint
+{
+	qint64 x;/**< x coord. */
+	qint64 y;/**< y coord.*/
+	longPoint(qint64,qint64);
+	longPoint();
+};
+
+/**
+Helper struct that handles coordinate transformations
+All of them are exact up to zoom 30.
+*/
+struct myMercator
+{
+	static longPoint geoCoordToPixel(QPointF const &,int , int);
+	static QPointF pixelToGeoCoord(longPoint const &, int, int);
+	static QPointF geoCoordToPixelF(QPointF const &, int, int);
+	static QPointF pixelToGeoCoordF(QPointF const &, int, int);
+	static void geoCoordsToPixels(const qreal *, const qreal *, qreal *, qreal *, int, int, int);
+	static void pixelsToGeoCoords(const qreal *, const qreal *, qreal *, qreal *, int, int, int);
+	static qreal mapSize(int, int);
+};
+
+/**
+* Struct to define a range of consecutive tiles
+* It's used to identify which tiles are visible and need to be rendered/downlaoded
+* @see tileSet::cover()
+*/
+struct tileSet
+{
+	int zoom;/**< zoom level.*/
+	qint32 top;/**< topmost row.*/
+	qint32 bottom;/**< bottommost row.*/
+	qint32 left;/**< leftmostcolumn. */
+	qint32 right;/**< rightmost column. */
+	int offsetx;/**< horizontal offset needed to align the tiles in the wiget.*/
+	int offsety;/**< vertical offset needed to align the tiles in the widget.*/
+	qint64 originx;/**< map px coord of the left edge of the widget.*/
+	qint64 originy;/**< map px coord of the top edge of the widget.*/
+
+	static tileSet cover(QPointF, int, QSize, int);
+	QPoint pixel(QPointF, int) const;
+};
+
+#endif
@@ -0,0 +1,162 @@
+#include "missingtiles.h"
+#include <QFile>
+#include <QDataStream>
+#include <QDateTime>
+#include <QDebug>
+
+#define MISSING_MAGIC 0x43434d54 //"CCMT"
+#define MISSING_VERSION 1
+
+/**
+* constructor
+* @param ttl seconds a missing %tile is remembered
+*/
+missingTiles::missingTiles(qint64 ttl)
+{
+    ttlSecs = ttl;
+    dirty = false;
+}
+
+/**
+* @return true if the server doesn't have the %tile. Expired entries are dropped.
+*/
+bool missingTiles::contains(const tileKey &key)
+{
+    QHash<tileKey,qint64>::iterator i = expiry.find(key);
+    if (i == expiry.end())
+    {
+        return false;
+    }
+    if (i.value() <= QDateTime::currentMSecsSinceEpoch()/1000)
+    {
+        expiry.erase(i);
+        dirty = true;
+        return false;
+    }
+    return true;
+}
+
+/**
+* Remembers a %tile the server doesn't have for the configured time
+*/
+void missingTiles::insert(const tileKey &key)
+{
+    expiry.insert(key, QDateTime::currentMSecsSinceEpoch()/1000 + ttlSecs);
+    dirty = true;
+}
+
+void missingTiles::remove(const tileKey &key)
+{
+    if (expiry.remove(key))
+    {
+        dirty = true;
+    }
+}
+
+void missingTiles::clear()
+{
+    if (!expiry.isEmpty())
+    {
+        expiry.clear();
+        dirty = true;
+    }
+}
+
+/**
+* @return number of tiles remembered, expired ones included until they're looked up
+*/
+int missingTiles::count() const
+{
+    return expiry.size();
+}
+
+/**
+* Sets how long a missing %tile is remembered. Only affects tiles inserted afterwards.
+* @param secs time in seconds, 0 to request them again on the next redraw
+*/
+void missingTiles::setTtl(qint64 secs)
+{
+    ttlSecs = qMax((qint64)0, secs);
+}
+
+qint64 missingTiles::ttl() const
+{
+    return ttlSecs;
+}
+
+/**
+* Replaces the list with the one saved in a file, skipping expired entries
+* Later calls to save() write to the same file.
+* @param file path of the list, it doesn't need to exist
+* @return false if the file couldn't be read
+*/
+bool missingTiles::load(const QString &file)
+{
+    fileName = file;
+    expiry.clear();
+    dirty = false;
+    QFile f(fileName);
+    if (!f.open(QIODevice::ReadOnly))
+    {
+        return false;
+    }
+    QByteArray data = f.readAll();
+    QDataStream in(data);
+    in.setVersion(QDataStream::Qt_5_0);
+    quint32 magic, version;
+    in >> magic >> version;
+    if (in.status() != QDataStream::Ok || magic != MISSING_MAGIC || version != MISSING_VERSION)
+    {
+        return false;
+    }
+    qint64 now = QDateTime::currentMSecsSinceEpoch()/1000;
+    while (!in.atEnd())
+    {
+        quint64 id;
+        qint64 until;
+        in >> id >> until;
+        if (in.status() != QDataStream::Ok)
+        {
+            break;
+        }
+        if (until > now)
+        {
+            tileKey key;
+            key.id = id;
+            expiry.insert(key, until);
+        }
+        else
+        {
+            dirty = true;
+        }
+    }
+    return true;
+}
+
+/**
+* Writes the list to the file given to load() if it changed
+* @return false if it couldn't be written
+*/
+bool missingTiles::save()
+{
+    if (!dirty || fileName.isEmpty())
+    {
+        return true;
+    }
+    QFile f(fileName);
+    if (!f.open(QIODevice::WriteOnly))
+    {
+        qDebug() <<"error writing to file "<<fileName;
+        return false;
+    }
+    QDataStream out(&f);
+    out.setVersion(QDataStream::Qt_5_0);
+    out << (quint32)MISSING_MAGIC << (quint32)MISSING_VERSION;
+    QHash<tileKey,qint64>::const_iterator i = expiry.constBegin();
+    for (; i!=expiry.constEnd(); ++i)
+    {
+        out << i.key().id << i.value();
+    }
+    dirty = false;
+    return true;
+}
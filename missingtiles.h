@@ -0,0 +1,43 @@
+#ifndef MISSINGTILES_H
+#define MISSINGTILES_H
+
+#include <QHash>
+#include <QString>
+#include "tilekey.h"
+
+/**
+* default time a %tile the server doesn't have is remembered
+*/
+#define MISSING_TTL 7*24*3600 //a week
+
+/**
+* Tiles the tile server answered with a 404
+* Each one is remembered for a while so it isn't requested on every redraw,
+* and the list is saved next to the %tile store so it survives restarts.
+* @see cacaMap::setMissingTileTtl()
+*/
+class missingTiles
+{
+public:
+    missingTiles(qint64 ttl = MISSING_TTL);
+
+    bool contains(const tileKey &);
+    void insert(const tileKey &);
+    void remove(const tileKey &);
+    void clear();
+    int count() const;
+
+    void setTtl(qint64);
+    qint64 ttl() const;
+
+    bool load(const QString &);
+    bool save();
+
+private:
+    QHash<tileKey,qint64> expiry;/**< time each %tile may be requested again, in seconds since epoch. */
+    qint64 ttlSecs;/**< how long a missing %tile is remembered. */
+    QString fileName;/**< file the list is saved to. */
+    bool dirty;/**< the list changed since it was saved. */
+};
+
+#endif
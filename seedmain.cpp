@@ -0,0 +1,149 @@
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QStringList>
+#include <QFile>
+#include <QDir>
+#include <iostream>
+#include "tileseeder.h"
+
+using namespace std;
+
+/**
+* @return the points of a "lat,lon;lat,lon;..." list as longitude/latitude
+*/
+static QPolygonF parsePoints(const QString &text)
+{
+    QPolygonF points;
+    QStringList pairs = text.split(';', Qt::SkipEmptyParts);
+    for (int k=0; k<pairs.size(); k++)
+    {
+        QStringList latlon = pairs.at(k).split(',');
+        if (latlon.size() == 2)
+        {
+            points << QPointF(latlon.at(1).toDouble(), latlon.at(0).toDouble());
+        }
+    }
+    return points;
+}
+
+/**
+* Downloads the tiles of an area for offline use
+* e.g. cacaseed --bbox 59.8,30.1,60.1,30.6 --zoom 10-15 --rate 5 --job spb.ini
+* Running it again with the same --job resumes where it stopped.
+*/
+int main(int argc, char **argv)
+{
+    QCoreApplication a(argc, argv);
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Downloads map tiles for offline use");
+    parser.addHelpOption();
+    QCommandLineOption bboxOption("bbox", "area as lat1,lon1,lat2,lon2", "box");
+    QCommandLineOption polygonOption("polygon", "area as lat,lon;lat,lon;...", "points");
+    QCommandLineOption zoomOption("zoom", "zoom range, e.g. 10-15", "range");
+    QCommandLineOption rateOption("rate", "maximum requests per second, 0 for no limit", "rate", "0");
+    QCommandLineOption concurrentOption("concurrent", "requests in flight", "n", "4");
+    QCommandLineOption serverOption("server", "name of a server in tileservers.xml, the default one otherwise", "name");
+    QCommandLineOption urlOption("url", "tile url template, e.g. http://localhost:8000/%z/%x/%y.png", "url");
+    QCommandLineOption mbtilesOption("mbtiles", "store the tiles in an .mbtiles file instead of the cache folder", "file");
+    QCommandLineOption jobOption("job", "job state file, an existing one is resumed", "file");
+    parser.addOption(bboxOption);
+    parser.addOption(polygonOption);
+    parser.addOption(zoomOption);
+    parser.addOption(rateOption);
+    parser.addOption(concurrentOption);
+    parser.addOption(serverOption);
+    parser.addOption(urlOption);
+    parser.addOption(mbtilesOption);
+    parser.addOption(jobOption);
+    parser.process(a);
+
+    seedJob job;
+    QString jobfile = parser.value(jobOption);
+    if (!jobfile.isEmpty() && QFile::exists(jobfile))
+    {
+        if (!job.load(jobfile))
+        {
+            cerr<<"can't read job "<<jobfile.toStdString()<<endl;
+            return 1;
+        }
+        cout<<"resuming "<<jobfile.toStdString()<<endl;
+    }
+    else
+    {
+        QStringList zooms = parser.value(zoomOption).split('-');
+        int minzoom = zooms.at(0).toInt();
+        int maxzoom = zooms.size() > 1 ? zooms.at(1).toInt() : minzoom;
+        if (parser.isSet(bboxOption))
+        {
+            QStringList box = parser.value(bboxOption).split(',');
+            if (box.size() != 4)
+            {
+                cerr<<"--bbox needs lat1,lon1,lat2,lon2"<<endl;
+                return 1;
+            }
+            job = seedJob::boundingBox(QPointF(box.at(1).toDouble(), box.at(0).toDouble()),
+                                       QPointF(box.at(3).toDouble(), box.at(2).toDouble()),
+                                       minzoom, maxzoom);
+        }
+        else if (parser.isSet(polygonOption))
+        {
+            job = seedJob::polygon(parsePoints(parser.value(polygonOption)), minzoom, maxzoom);
+        }
+        if (job.area.size() < 3 || !parser.isSet(zoomOption))
+        {
+            parser.showHelp(1);
+        }
+    }
+
+    //same servers and cache folders as the map widget
+    servermanager layout;
+    layout.load(QDir::currentPath()+"/tileservers.xml");
+    if (parser.isSet(serverOption)
+        && !layout.setCurrentServer(layout.serverNames().indexOf(parser.value(serverOption))))
+    {
+        cerr<<"no server "<<parser.value(serverOption).toStdString()<<" in tileservers.xml"<<endl;
+        return 1;
+    }
+    if (parser.isSet(urlOption))
+    {
+        layout.setTileUrl(parser.value(urlOption));
+    }
+    tileStore *store;
+    if (parser.isSet(mbtilesOption))
+    {
+        store = new mbtilesTileStore(parser.value(mbtilesOption));
+    }
+    else
+    {
+        store = new dirTileStore(QDir::currentPath(), layout);
+    }
+
+    //same index as the map widget, so it knows about the new tiles
+    tileDiskCache cache(store);
+    //the whole area has to stay, whatever the budget of the map is
+    cache.setMaxSize((qint64)1<<50);
+    QString location = store->location();
+    if (!cache.openIndex(location+".idx", location))
+    {
+        cache.reset(store->scan());
+    }
+
+    tileSeeder seeder(store, layout);
+    seeder.setDiskCache(&cache);
+    seeder.setJobFile(jobfile);
+    seeder.setRateLimit(parser.value(rateOption).toDouble());
+    seeder.setMaxConcurrent(parser.value(concurrentOption).toInt());
+    QObject::connect(&seeder, &tileSeeder::progress, [](quint64 done, quint64 total) {
+        cout<<"\r"<<done<<"/"<<total<<" tiles"<<flush;
+    });
+    QObject::connect(&seeder, &tileSeeder::finished, &a, &QCoreApplication::quit);
+    seeder.start(job);
+    int ret = seeder.isRunning() ? a.exec() : 0;
+
+    seedJob done = seeder.job();
+    cout<<endl<<done.downloaded<<" downloaded, "<<done.skipped<<" already cached, "<<done.failed<<" failed"<<endl;
+    cache.closeIndex();
+    store->flush();
+    delete store;
+    return ret ? ret : (done.failed ? 2 : 0);
+}
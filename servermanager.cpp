@@ -0,0 +1,313 @@
+#include "servermanager.h"
+#include <QFile>
+#include <QFileInfo>
+#include <QDir>
+#include <QXmlStreamReader>
+#include <QDebug>
+
+/**
+* @return the server used when there's no tileservers.xml, and by versions
+* that didn't read it
+*/
+static tileserver builtInServer()
+{
+    tileserver serveritem;
+
+    serveritem.name = "OSM cahced";
+    //serveritem.url = "http://{s}.tile.openstreetmap.org/%z/%x/%y.png";
+    serveritem.url = "http://mt1.google.com/vt/x=%x&y=%y&z=%z";
+    serveritem.folder = "map_cache";
+    serveritem.path = "/%z/%x/";
+    serveritem.tile = "%y.png";
+    serveritem.maxZoom = 18;
+    serveritem.subdomains << "a" << "b" << "c";
+    return serveritem;
+}
+
+/**
+* constructor, there's a single built-in server until load() is called
+*/
+servermanager::servermanager()
+{
+    servers.append(builtInServer());
+    current = 0;
+    servermain = servers.at(0);
+    compileTemplates();
+}
+
+/**
+* Reads the tile servers from an xml file like tileservers.xml
+* Each server has name, url, folder, filepath and tile elements, and
+* optionally maxzoom and a comma separated list of subdomains.
+* The server with the default attribute becomes the current one.
+* @param file path of the xml file
+* @return false if the file has no usable server, the list is left as it was then
+*/
+bool servermanager::load(const QString &file)
+{
+    QFile f(file);
+    if (!f.open(QIODevice::ReadOnly))
+    {
+        return false;
+    }
+    QList<tileserver> loaded;
+    int defaultserver = 0;
+    QXmlStreamReader xml(&f);
+    if (xml.readNextStartElement() && xml.name() == QLatin1String("cacamap"))
+    {
+        while (xml.readNextStartElement())
+        {
+            if (xml.name() != QLatin1String("server"))
+            {
+                xml.skipCurrentElement();
+                continue;
+            }
+            if (xml.attributes().hasAttribute("default"))
+            {
+                defaultserver = loaded.size();
+            }
+            tileserver server = servers.at(0);
+            server.subdomains = QStringList() << "a" << "b" << "c";
+            server.maxZoom = 18;
+            while (xml.readNextStartElement())
+            {
+                QString tag = xml.name().toString();
+                QString text = xml.readElementText().trimmed();
+                if (tag == "name") server.name = text;
+                else if (tag == "url") server.url = text;
+                else if (tag == "folder") server.folder = text;
+                else if (tag == "filepath") server.path = text;
+                else if (tag == "tile") server.tile = text;
+                else if (tag == "maxzoom") server.maxZoom = text.toInt();
+                else if (tag == "subdomains") server.subdomains = text.split(',');
+            }
+            loaded.append(server);
+        }
+    }
+    if (xml.hasError() || loaded.isEmpty())
+    {
+        qDebug() <<"can't read tile servers from "<<file<<xml.errorString();
+        return false;
+    }
+    servers = loaded;
+    current = -1;
+    if (keepLegacyServer(QFileInfo(file).absolutePath()))
+    {
+        defaultserver = 0;
+    }
+    setCurrentServer(qMin(defaultserver, servers.size()-1));
+    return true;
+}
+
+/**
+* Versions that didn't read tileservers.xml cached everything from the built-in
+* server. If its folder is there, the built-in server is kept in the list and
+* stays the current one, so an upgrade neither loses nor re-downloads those tiles.
+* @param root folder the cache folders are in
+* @return true if the built-in server was kept
+*/
+bool servermanager::keepLegacyServer(const QString &root)
+{
+    tileserver builtin = builtInServer();
+    if (!QDir(root).exists(builtin.folder))
+    {
+        return false;
+    }
+    for (int i=0; i<servers.size(); i++)
+    {
+        if (servers.at(i).folder == builtin.folder)
+        {
+            return false;
+        }
+    }
+    servers.prepend(builtin);
+    return true;
+}
+
+/**
+* @return number of known tile servers
+*/
+int servermanager::count() const
+{
+    return servers.size();
+}
+
+/**
+* @return names of the tile servers, in the order of their indexes
+*/
+QStringList servermanager::serverNames() const
+{
+    QStringList names;
+    for (int i=0; i<servers.size(); i++)
+    {
+        names << servers.at(i).name;
+    }
+    return names;
+}
+
+/**
+* @return index of the current server
+*/
+int servermanager::currentServer() const
+{
+    return current;
+}
+
+/**
+* Makes another server the current one
+* @param index index of the server
+* @return false if there's no such server
+*/
+bool servermanager::setCurrentServer(int index)
+{
+    if (index < 0 || index >= servers.size())
+    {
+        return false;
+    }
+    if (current >= 0 && current < servers.size())
+    {
+        servers[current] = servermain;
+    }
+    current = index;
+    servermain = servers.at(index);
+    compileTemplates();
+    return true;
+}
+
+/**
+* Parses the templates of the server, they aren't looked at again until they change
+*/
+void servermanager::compileTemplates()
+{
+    urlTemplate = tileTemplate(servermain.url, servermain.subdomains);
+    pathTemplate = tileTemplate(servermain.path);
+    nameTemplate = tileTemplate(servermain.tile);
+    dirTemplate = tileTemplate(servermain.folder+servermain.path);
+    fileTemplate = tileTemplate(servermain.folder+servermain.path+servermain.tile);
+}
+
+
+/**
+* Get URL of a specific %tile
+* @param zoom zoom level
+* @return string containing the url where the %tile image can be found.
+*/
+QString servermanager::getTileUrl(int zoom, quint32 x, quint32 y) const
+{
+    QString url;
+    urlTemplate.format(zoom,x,y,url);
+    return url;
+}
+
+/**
+* @return url where the %tile image can be found
+*/
+QString servermanager::getTileUrl(const tileKey &key) const
+{
+    return urlTemplate.format(key);
+}
+
+/**
+* Changes where tiles are downloaded from, e.g. a local mirror
+* @param url url template, %z %x and %y are replaced by the %tile coordinates
+* @see tileTemplate for the other fields
+*/
+void servermanager::setTileUrl(const QString &url)
+{
+    servermain.url = url;
+    urlTemplate.parse(url);
+}
+
+/**
+* @return deepest zoom level the server has tiles for
+*/
+int servermanager::maxZoom() const
+{
+    return servermain.maxZoom;
+}
+
+/**
+* Sets the deepest zoom level the server has tiles for
+* Nothing deeper is ever requested from it.
+*/
+void servermanager::setMaxZoom(int zoom)
+{
+    servermain.maxZoom = zoom;
+}
+
+/**
+* @return name of the cache folder for the given tile server
+*/
+QString servermanager::tileCacheFolder() const
+{
+    return  servermain.folder;
+}
+
+/**
+* @return tile file name, only %y is filled in
+*/
+QString servermanager::fileName(quint32 y) const
+{
+    QString name;
+    nameTemplate.format(0,0,y,name);
+    return name;
+}
+
+/**
+* @return tile file path, only %z and %x are filled in
+*/
+QString servermanager::filePath(int zoom, quint32 x) const
+{
+    QString path;
+    pathTemplate.format(zoom,x,0,path);
+    return path;
+}
+
+
+/**
+* @return path of the %tile file relative to the application folder
+*/
+QString servermanager::tileFile(const tileKey &key) const
+{
+    return fileTemplate.format(key);
+}
+
+/**
+* Appends the path of the %tile file relative to the application folder
+* @param key %tile
+* @param out string appended to
+*/
+void servermanager::tileFile(const tileKey &key, QString &out) const
+{
+    fileTemplate.format(key,out);
+}
+
+/**
+* Appends the folder of the %tile file relative to the application folder
+* @param key %tile
+* @param out string appended to
+*/
+void servermanager::tileDir(const tileKey &key, QString &out) const
+{
+    dirTemplate.format(key,out);
+}
+
+/**
+* Finds the %tile a file of the cache belongs to, the inverse of tileFile()
+* @param file path relative to the application folder
+* @param key receives the %tile
+* @return false if the file isn't a %tile of this server's layout
+*/
+bool servermanager::tileOf(const QString &file, tileKey &key) const
+{
+    //formatting it back rules out leading zeros and ambiguous templates
+    return fileTemplate.match(file,key) && fileTemplate.format(key) == file;
+}
+
+/**
+* @return server name
+*/
+QString servermanager::serverName() const
+{
+    return servermain.name;
+}
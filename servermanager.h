@@ -0,0 +1,63 @@
+#ifndef SERVERMANAGER_H
+#define SERVERMANAGER_H
+
+#include <QString>
+#include <QStringList>
+#include <QList>
+#include "tilekey.h"
+#include "tiletemplate.h"
+
+struct tileserver
+{
+    QString name;/**<name of the tile server*/
+    QString url;/**< url template for accessing tiles*/
+    QString folder;/**< name of folder where tiles will be stored*/
+    QString path;/**< path where tiles will be stored*/
+    QString tile;/**< tile file*/
+    int maxZoom;/**< deepest zoom level the server has tiles for*/
+    QStringList subdomains;/**< what %s in the url is replaced by*/
+};
+
+/**
+* The tile servers the map can show, one of them is current
+* Every other method works on the current server.
+*/
+class servermanager
+{
+public:
+    servermanager();
+    bool load(const QString &);
+    int count() const;
+    QStringList serverNames() const;
+    int currentServer() const;
+    bool setCurrentServer(int);
+    QString getTileUrl(int,quint32,quint32) const;
+    QString getTileUrl(const tileKey &) const;
+    void setTileUrl(const QString &);
+    int maxZoom() const;
+    void setMaxZoom(int);
+    QString tileCacheFolder() const;
+    //returns the filename of the file as it should be stored in HD
+    QString fileName(quint32) const;
+    QString serverName() const;
+    QString filePath(int, quint32) const;
+    QString tileFile(const tileKey &) const;
+    void tileFile(const tileKey &, QString &) const;
+    void tileDir(const tileKey &, QString &) const;
+    bool tileOf(const QString &, tileKey &) const;
+
+private:
+    QList<tileserver> servers;/**< all known tile servers. */
+    int current;/**< index of the current server. */
+    tileserver servermain;/**< copy of the current server. */
+    tileTemplate urlTemplate;/**< compiled servermain.url. */
+    tileTemplate pathTemplate;/**< compiled servermain.path. */
+    tileTemplate nameTemplate;/**< compiled servermain.tile. */
+    tileTemplate dirTemplate;/**< compiled folder and path together. */
+    tileTemplate fileTemplate;/**< compiled folder, path and tile together. */
+
+    void compileTemplates();
+    bool keepLegacyServer(const QString &);
+};
+
+#endif
@@ -0,0 +1,180 @@
+#include "staticmap.h"
+#include <QThread>
+
+/**
+* patches are not cut smaller than this, they're unintelligible anyways
+*/
+#define STATICMAP_MIN_PATCH 16
+
+/**
+* constructor, a 256x256 map of the whole world
+*/
+staticMapRequest::staticMapRequest()
+{
+    zoom = 0;
+    size = QSize(256,256);
+}
+
+/**
+* constructor
+* @param _renderer renderer the image is posted to
+* @param _id id of the render
+* @param _request what to render
+*/
+staticMapTask::staticMapTask(staticMapRenderer *_renderer, int _id, const staticMapRequest &_request)
+{
+    renderer = _renderer;
+    id = _id;
+    request = _request;
+}
+
+void staticMapTask::run()
+{
+    QImage image = renderer->render(request);
+    QMetaObject::invokeMethod(renderer, "slotRenderDone", Qt::QueuedConnection,
+                              Q_ARG(int, id),
+                              Q_ARG(QImage, image));
+}
+
+/**
+* constructor
+* @param _store where tiles are read from, read() has to be thread safe
+* @param tilesize size in px of the square %tile
+*/
+staticMapRenderer::staticMapRenderer(tileStore *_store, QObject *_parent, int tilesize):QObject(_parent)
+{
+    store = _store;
+    tileSize = tilesize;
+    pool.setMaxThreadCount(QThread::idealThreadCount());
+    nextId.storeRelease(0);
+}
+
+/**
+* destructor, waits for the running renders so none of them posts to a dead object
+*/
+staticMapRenderer::~staticMapRenderer()
+{
+    pool.clear();
+    pool.waitForDone();
+}
+
+/**
+* Renders a map and the overlays on top of it
+* @param request center, zoom, size and overlays
+* @return the map image
+*/
+QImage staticMapRenderer::render(const staticMapRequest &request) const
+{
+    QImage image(request.size, QImage::Format_RGB32);
+    image.fill(Qt::gray);
+    tileSet view = tileSet::cover(request.center, request.zoom, request.size, tileSize);
+    //tiles decoded for this render, patches often share a parent
+    QHash<tileKey,QImage> decoded;
+
+    QPainter p(&image);
+    p.setRenderHint(QPainter::SmoothPixmapTransform);
+    qint32 numtiles = 1<<view.zoom;
+    for (qint32 i=view.left; i<=view.right; i++)
+    {
+        //wrap around the tiles horizontally
+        qint32 valx = ((i<0)*numtiles + i%numtiles)%numtiles;
+        for (qint32 j=view.top; j<=view.bottom; j++)
+        {
+            //no vertical wrapping
+            if (j<0 || j>=numtiles)
+            {
+                continue;
+            }
+            QRect target((i-view.left)*tileSize - view.offsetx, (j-view.top)*tileSize - view.offsety, tileSize, tileSize);
+            drawTile(p, target, tileKey(view.zoom,valx,j), decoded);
+        }
+    }
+    for (int k=0; k<request.overlays.size(); k++)
+    {
+        p.save();
+        request.overlays.at(k)->paint(p, view, tileSize);
+        p.restore();
+    }
+    return image;
+}
+
+/**
+* Draws a %tile, or the part of the closest cached ancestor that covers it
+*/
+void staticMapRenderer::drawTile(QPainter &p, const QRect &target, const tileKey &key, QHash<tileKey,QImage> &decoded) const
+{
+    tileKey ancestor = key;
+    for (int dz=0; (tileSize>>dz) >= STATICMAP_MIN_PATCH; dz++)
+    {
+        QImage image = loadTile(ancestor, decoded);
+        if (!image.isNull())
+        {
+            //part of the ancestor covered by the tile
+            int patch = tileSize>>dz;
+            quint32 mask = ((quint32)1<<dz) - 1;
+            QRect source((key.x() & mask)*patch, (key.y() & mask)*patch, patch, patch);
+            p.drawImage(target, image, source);
+            return;
+        }
+        if (ancestor.zoom() == 0)
+        {
+            return;
+        }
+        ancestor = ancestor.parent();
+    }
+}
+
+/**
+* @return decoded %tile, null if it isn't in the store
+*/
+QImage staticMapRenderer::loadTile(const tileKey &key, QHash<tileKey,QImage> &decoded) const
+{
+    QHash<tileKey,QImage>::const_iterator i = decoded.constFind(key);
+    if (i != decoded.constEnd())
+    {
+        return i.value();
+    }
+    QImage image;
+    image.loadFromData(store->read(key));
+    //misses are kept too, so they aren't read again
+    decoded.insert(key, image);
+    return image;
+}
+
+/**
+* Queues a render on the thread pool
+* @return id passed to rendered() along with the image
+*/
+int staticMapRenderer::renderAsync(const staticMapRequest &request)
+{
+    int id = nextId.fetchAndAddOrdered(1);
+    pool.start(new staticMapTask(this, id, request));
+    return id;
+}
+
+/**
+* Blocks until all the queued renders are done. Their rendered() signals
+* are delivered once the event loop runs.
+*/
+void staticMapRenderer::waitForDone()
+{
+    pool.waitForDone();
+}
+
+/**
+* Sets how many maps are rendered at once
+*/
+void staticMapRenderer::setMaxThreads(int threads)
+{
+    pool.setMaxThreadCount(qMax(1, threads));
+}
+
+int staticMapRenderer::maxThreads() const
+{
+    return pool.maxThreadCount();
+}
+
+void staticMapRenderer::slotRenderDone(int id, QImage image)
+{
+    emit rendered(id, image);
+}
@@ -0,0 +1,86 @@
+#ifndef STATICMAP_H
+#define STATICMAP_H
+
+#include <QObject>
+#include <QRunnable>
+#include <QThreadPool>
+#include <QAtomicInt>
+#include <QImage>
+#include <QPainter>
+#include <QHash>
+#include <QList>
+#include <QSharedPointer>
+#include "tilekey.h"
+#include "mercator.h"
+#include "tilestore.h"
+#include "mapoverlay.h"
+
+/**
+* What to render
+*/
+struct staticMapRequest
+{
+    QPointF center;/**< longitude and latitude of the center in degrees. */
+    int zoom;/**< zoom level. */
+    QSize size;/**< size of the image in px. */
+    QList<QSharedPointer<mapOverlay> > overlays;/**< drawn on top of the tiles, in order. */
+
+    staticMapRequest();
+};
+
+class staticMapRenderer;
+
+/**
+* Renders one map on a worker thread
+* @see staticMapRenderer::renderAsync()
+*/
+class staticMapTask : public QRunnable
+{
+public:
+    staticMapTask(staticMapRenderer *, int, const staticMapRequest &);
+    void run();
+
+private:
+    staticMapRenderer *renderer;/**< renders and receives the image. */
+    int id;/**< id handed out by renderAsync(). */
+    staticMapRequest request;/**< what to render. */
+};
+
+/**
+* Renders maps to images without a widget, only from the %tile store
+* Nothing is ever downloaded: missing tiles are patched from a lower zoom
+* level like the map does, or left blank. render() can be called from any
+* thread, renderAsync() runs many renders in parallel on a thread pool.
+*/
+class staticMapRenderer : public QObject
+{
+    Q_OBJECT
+
+public:
+    staticMapRenderer(tileStore *, QObject *_parent=0, int tilesize=256);
+    ~staticMapRenderer();
+
+    QImage render(const staticMapRequest &) const;
+    int renderAsync(const staticMapRequest &);
+    void waitForDone();
+
+    void setMaxThreads(int);
+    int maxThreads() const;
+
+signals:
+    void rendered(int, QImage);
+
+private:
+    tileStore *store;/**< where tiles are read from. */
+    int tileSize;/**< size in px of the square %tile. */
+    QThreadPool pool;/**< worker threads doing the renders. */
+    QAtomicInt nextId;/**< id of the next asynchronous render. */
+
+    void drawTile(QPainter &, const QRect &, const tileKey &, QHash<tileKey,QImage> &) const;
+    QImage loadTile(const tileKey &, QHash<tileKey,QImage> &) const;
+
+private slots:
+    void slotRenderDone(int, QImage);
+};
+
+#endif
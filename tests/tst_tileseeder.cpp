@@ -0,0 +1,231 @@
+#include <QtTest>
+#include <QTcpServer>
+#include <QTcpSocket>
+#include <QTemporaryDir>
+#include <QElapsedTimer>
+#include <QSet>
+#include "../tileseeder.h"
+
+/**
+* Local stand-in for a tile server, answers every request with the same tile
+* and remembers what was asked and when
+*/
+class standInServer : public QTcpServer
+{
+    Q_OBJECT
+
+public:
+    standInServer()
+    {
+        connect(this, SIGNAL(newConnection()),this, SLOT(slotConnection()));
+        clock.start();
+    }
+
+    /**
+    * @return url template pointing at the server
+    */
+    QString url() const
+    {
+        return QString("http://127.0.0.1:%1/%z/%x/%y.png").arg(serverPort());
+    }
+
+    QStringList paths;/**< path of every request, in order. */
+    QList<qint64> times;/**< when each request came in, in ms since the server started. */
+    QElapsedTimer clock;/**< started with the server. */
+
+signals:
+    void requested(int);
+
+private slots:
+    void slotConnection()
+    {
+        while (hasPendingConnections())
+        {
+            QTcpSocket *socket = nextPendingConnection();
+            connect(socket, SIGNAL(readyRead()),this, SLOT(slotRead()));
+            connect(socket, SIGNAL(disconnected()),socket, SLOT(deleteLater()));
+        }
+    }
+
+    void slotRead()
+    {
+        QTcpSocket *socket = qobject_cast<QTcpSocket *>(sender());
+        QByteArray buffer = socket->property("buffer").toByteArray() + socket->readAll();
+        int end;
+        while ((end = buffer.indexOf("\r\n\r\n")) >= 0)
+        {
+            QByteArray head = buffer.left(end);
+            buffer.remove(0, end+4);
+            paths << QString::fromLatin1(head.split(' ').value(1));
+            times << clock.elapsed();
+            QByteArray body("tile");
+            socket->write("HTTP/1.1 200 OK\r\nContent-Type: image/png\r\nContent-Length: "
+                          + QByteArray::number(body.size()) + "\r\n\r\n" + body);
+            emit requested(paths.size());
+        }
+        socket->setProperty("buffer", buffer);
+    }
+};
+
+/**
+* Runs tileSeeder against standInServer
+*/
+class tst_tileSeeder : public QObject
+{
+    Q_OBJECT
+
+private:
+    standInServer server;
+    seedJob area() const;
+    servermanager layout() const;
+
+private slots:
+    void initTestCase();
+    void init();
+    void rateLimit();
+    void skipCached();
+    void resume();
+};
+
+/**
+* @return a small job, a few tiles around 0,0 at two zoom levels
+*/
+seedJob tst_tileSeeder::area() const
+{
+    return seedJob::boundingBox(QPointF(0.0, 0.0), QPointF(1.0, 1.0), 9, 10);
+}
+
+/**
+* @return the built-in server pointed at the stand-in
+*/
+servermanager tst_tileSeeder::layout() const
+{
+    servermanager l;
+    l.setTileUrl(server.url());
+    return l;
+}
+
+void tst_tileSeeder::initTestCase()
+{
+    QVERIFY(server.listen(QHostAddress::LocalHost));
+}
+
+void tst_tileSeeder::init()
+{
+    server.paths.clear();
+    server.times.clear();
+}
+
+/**
+* Requests never go out faster than the rate, and every %tile is asked for once
+*/
+void tst_tileSeeder::rateLimit()
+{
+    QTemporaryDir dir;
+    dirTileStore store(dir.path(), layout());
+    tileSeeder seeder(&store, layout());
+    seeder.setRateLimit(10);
+    QSignalSpy done(&seeder, SIGNAL(finished(bool)));
+    qint64 start = server.clock.elapsed();
+    QVERIFY(seeder.start(area()));
+    QVERIFY(done.wait(20000));
+    QCOMPARE(done.first().first().toBool(), true);
+
+    quint64 total = tileSeeder::countTiles(area());
+    QVERIFY(total > 10);
+    QCOMPARE((quint64)server.paths.size(), total);
+    QCOMPARE((quint64)QSet<QString>(server.paths.begin(), server.paths.end()).size(), total);
+    for (int k=0; k<server.times.size(); k++)
+    {
+        //one token to start with, then one every 100 ms
+        QVERIFY2(server.times.at(k) - start >= k*100 - 50,
+                 qPrintable(QString("request %1 after %2 ms").arg(k).arg(server.times.at(k) - start)));
+    }
+    QCOMPARE(seeder.job().downloaded, total);
+}
+
+/**
+* Tiles already in the store are counted as skipped and not requested
+*/
+void tst_tileSeeder::skipCached()
+{
+    QTemporaryDir dir;
+    dirTileStore store(dir.path(), layout());
+    seedIterator walk(area());
+    tileKey key;
+    int cached = 0;
+    while (walk.next(key))
+    {
+        if (cached < 5 && store.write(key, "cached"))
+        {
+            cached++;
+        }
+    }
+    tileSeeder seeder(&store, layout());
+    QSignalSpy done(&seeder, SIGNAL(finished(bool)));
+    QVERIFY(seeder.start(area()));
+    QVERIFY(done.wait(20000));
+
+    quint64 total = tileSeeder::countTiles(area());
+    QCOMPARE(seeder.job().skipped, (quint64)cached);
+    QCOMPARE((quint64)server.paths.size(), total - cached);
+}
+
+/**
+* A job stopped half way resumes from its ini file, the second run only asks
+* for what isn't stored yet and the counters add up to the whole job
+*/
+void tst_tileSeeder::resume()
+{
+    QTemporaryDir dir;
+    QString jobfile = dir.filePath("job.ini");
+    dirTileStore store(dir.path(), layout());
+    quint64 total = tileSeeder::countTiles(area());
+    {
+        tileSeeder seeder(&store, layout());
+        seeder.setJobFile(jobfile);
+        seeder.setRateLimit(20);
+        QSignalSpy stopped(&seeder, SIGNAL(finished(bool)));
+        connect(&server, &standInServer::requested, &seeder, [&seeder](int n) {
+            if (n == 6)
+            {
+                seeder.stop();
+            }
+        });
+        QVERIFY(seeder.start(area()));
+        QVERIFY(stopped.wait(20000));
+        QCOMPARE(stopped.first().first().toBool(), false);
+    }
+
+    seedJob saved;
+    QVERIFY(saved.load(jobfile));
+    QVERIFY(saved.cursor.isValid());
+    QVERIFY(saved.processed() < total);
+    QSet<QString> first(server.paths.begin(), server.paths.end());
+    server.paths.clear();
+
+    tileSeeder seeder(&store, layout());
+    seeder.setJobFile(jobfile);
+    QSignalSpy done(&seeder, SIGNAL(finished(bool)));
+    QVERIFY(seeder.start(saved));
+    QVERIFY(done.wait(20000));
+    QCOMPARE(done.first().first().toBool(), true);
+
+    seedJob finished = seeder.job();
+    QCOMPARE(finished.failed, (quint64)0);
+    QCOMPARE(finished.processed(), total);
+    QSet<QString> second(server.paths.begin(), server.paths.end());
+    QCOMPARE((quint64)(first + second).size(), total);
+    //what the first run stored isn't asked for again
+    QCOMPARE((quint64)second.size(), total - saved.downloaded);
+
+    seedIterator walk(area());
+    tileKey key;
+    while (walk.next(key))
+    {
+        QVERIFY(store.contains(key));
+    }
+}
+
+QTEST_GUILESS_MAIN(tst_tileSeeder)
+#include "tst_tileseeder.moc"
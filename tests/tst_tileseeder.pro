@@ -0,0 +1,8 @@
+TEMPLATE = app
+TARGET = tst_tileseeder
+CONFIG += console testcase
+QT+=network sql testlib
+INCLUDEPATH += ..
+# Input
+HEADERS += ../tilekey.h ../tilefreshness.h ../mercator.h ../tiletemplate.h ../servermanager.h ../tilestore.h ../tiledownloader.h ../tilediskcache.h ../tileseeder.h
+SOURCES += ../mercator.cpp ../tiletemplate.cpp ../servermanager.cpp ../tilestore.cpp ../tiledownloader.cpp ../tilediskcache.cpp ../tileseeder.cpp tst_tileseeder.cpp
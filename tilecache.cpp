@@ -0,0 +1,177 @@
+#include "tilecache.h"
+
+/**
+* constructor
+* @param maxbytes memory budget for decoded tiles
+*/
+tileMemCache::tileMemCache(int maxbytes)
+{
+    cache.setMaxCost(maxbytes);
+    hitCount = 0;
+    missCount = 0;
+}
+
+/**
+* Looks up a decoded %tile and marks it as most recently used
+* @param key %tile to look up
+* @param pixmap receives the decoded image if found
+* @return true on a cache hit
+*/
+bool tileMemCache::find(const tileKey &key, QPixmap &pixmap)
+{
+    QPixmap *cached = cache.object(key);
+    if (cached)
+    {
+        hitCount++;
+        pixmap = *cached;
+        return true;
+    }
+    missCount++;
+    return false;
+}
+
+/**
+* @return true if the %tile is in memory. Doesn't touch the LRU order or the stats.
+*/
+bool tileMemCache::contains(const tileKey &key) const
+{
+    return cache.contains(key);
+}
+
+/**
+* Adds a decoded %tile, evicting the least recently used ones if needed.
+* Tiles bigger than the whole budget are not kept.
+*/
+void tileMemCache::insert(const tileKey &key, const QPixmap &pixmap)
+{
+    if (pixmap.isNull())
+    {
+        return;
+    }
+    cache.insert(key, new QPixmap(pixmap), pixmapCost(pixmap));
+}
+
+void tileMemCache::remove(const tileKey &key)
+{
+    cache.remove(key);
+}
+
+void tileMemCache::clear()
+{
+    cache.clear();
+}
+
+/**
+* Changes the memory budget. Shrinking it evicts tiles right away.
+*/
+void tileMemCache::setMaxBytes(int maxbytes)
+{
+    cache.setMaxCost(maxbytes);
+}
+
+int tileMemCache::maxBytes() const
+{
+    return cache.maxCost();
+}
+
+/**
+* @return bytes currently used by decoded tiles
+*/
+int tileMemCache::usedBytes() const
+{
+    return cache.totalCost();
+}
+
+/**
+* @return number of tiles in memory
+*/
+int tileMemCache::count() const
+{
+    return cache.count();
+}
+
+quint64 tileMemCache::hits() const
+{
+    return hitCount;
+}
+
+quint64 tileMemCache::misses() const
+{
+    return missCount;
+}
+
+void tileMemCache::resetStats()
+{
+    hitCount = 0;
+    missCount = 0;
+}
+
+/**
+* @return approximate memory used by the pixel data of a pixmap
+*/
+int tileMemCache::pixmapCost(const QPixmap &pixmap)
+{
+    return pixmap.width()*pixmap.height()*pixmap.depth()/8;
+}
+
+/**
+* constructor
+* @param maxbytes memory budget for the images
+*/
+derivedTileCache::derivedTileCache(int maxbytes)
+{
+    cache.setMaxCost(maxbytes);
+}
+
+/**
+* Looks up an image made for a %tile
+* @param key %tile the image is drawn for
+* @param tag how it was made, e.g. levels up to the ancestor a patch was cut from
+* @param pixmap receives the image if found
+* @return true if the image was already made
+*/
+bool derivedTileCache::find(const tileKey &key, int tag, QPixmap &pixmap)
+{
+    QPixmap *cached = cache.object(derivedKey(key.id,tag));
+    if (cached)
+    {
+        pixmap = *cached;
+        return true;
+    }
+    return false;
+}
+
+void derivedTileCache::insert(const tileKey &key, int tag, const QPixmap &pixmap)
+{
+    if (pixmap.isNull())
+    {
+        return;
+    }
+    cache.insert(derivedKey(key.id,tag), new QPixmap(pixmap), tileMemCache::pixmapCost(pixmap));
+}
+
+/**
+* Drops all images, e.g. when a %tile they were made of was downloaded again and may have changed
+*/
+void derivedTileCache::clear()
+{
+    cache.clear();
+}
+
+void derivedTileCache::setMaxBytes(int maxbytes)
+{
+    cache.setMaxCost(maxbytes);
+}
+
+int derivedTileCache::maxBytes() const
+{
+    return cache.maxCost();
+}
+
+/**
+* @return bytes currently used by the images
+*/
+int derivedTileCache::usedBytes() const
+{
+    return cache.totalCost();
+}
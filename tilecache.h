@@ -0,0 +1,69 @@
+#ifndef TILECACHE_H
+#define TILECACHE_H
+
+#include <QCache>
+#include <QPair>
+#include <QPixmap>
+#include "tilekey.h"
+
+/**
+* In-memory cache of decoded tiles.
+* Tiles are charged by the size of their decoded pixel data and the least
+* recently used ones are evicted once the byte budget is exceeded.
+* @see cacaMap::setMemCacheSize()
+*/
+class tileMemCache
+{
+public:
+    tileMemCache(int maxbytes = 64*1024*1024);
+
+    bool find(const tileKey &, QPixmap &);
+    bool contains(const tileKey &) const;
+    void insert(const tileKey &, const QPixmap &);
+    void remove(const tileKey &);
+    void clear();
+
+    void setMaxBytes(int);
+    int maxBytes() const;
+    int usedBytes() const;
+    int count() const;
+
+    quint64 hits() const;
+    quint64 misses() const;
+    void resetStats();
+
+    static int pixmapCost(const QPixmap &);
+
+private:
+    QCache<tileKey,QPixmap> cache;/**< decoded tiles, cost is in bytes. */
+    quint64 hitCount;/**< number of successful lookups. */
+    quint64 missCount;/**< number of failed lookups. */
+};
+
+/**
+* Images made out of cached tiles, keyed by the %tile and a tag saying how they were made.
+* Used for the patches cut from an ancestor and scaled up, tagged with how many
+* levels up the ancestor is, and for the blended layers, tagged with the layer set version.
+* Each one is only made once.
+* @see cacaMap::getTilePatch()
+* @see cacaMap::compositeTile()
+*/
+class derivedTileCache
+{
+public:
+    derivedTileCache(int maxbytes = 16*1024*1024);
+
+    bool find(const tileKey &, int, QPixmap &);
+    void insert(const tileKey &, int, const QPixmap &);
+    void clear();
+
+    void setMaxBytes(int);
+    int maxBytes() const;
+    int usedBytes() const;
+
+private:
+    typedef QPair<quint64,int> derivedKey;/**< %tile id and tag. */
+    QCache<derivedKey,QPixmap> cache;/**< the images, cost is in bytes. */
+};
+
+#endif
@@ -0,0 +1,675 @@
+#include "tilediskcache.h"
+#include <QDateTime>
+#include <QCoreApplication>
+#include <QDataStream>
+#include <QFileInfo>
+#include <QDebug>
+#include <QMetaType>
+#include <QVector>
+#include <QPair>
+#include <algorithm>
+
+#define INDEX_MAGIC 0x43434958 //"CCIX"
+#define INDEX_VERSION 2
+#define INDEX_CLEAN_OFFSET 8 //right after magic and version
+#define INDEX_INSERT 1
+#define INDEX_REMOVE 2
+/**
+* the index file is rewritten once it has this many stale records,
+* or twice as many as live tiles, whichever is bigger
+*/
+#define INDEX_MIN_COMPACT 10000
+
+/**
+* constructor
+* @param _cache disk cache the result is posted to
+* @param _index snapshot of the index
+* @param _bytes how many bytes have to be deleted
+* @param _store where the tiles are deleted from
+*/
+diskEvictTask::diskEvictTask(tileDiskCache *_cache, const tileIndex &_index, qint64 _bytes, tileStore *_store)
+{
+    cache = _cache;
+    index = _index;
+    bytesToFree = _bytes;
+    store = _store;
+}
+
+/**
+* Sorts the tiles by last access and deletes the oldest ones.
+* Tiles the GUI thread used or wrote since the snapshot are skipped.
+*/
+void diskEvictTask::run()
+{
+    QVector<QPair<qint64,quint64> > order;
+    order.reserve(index.size());
+    tileIndex::const_iterator i = index.constBegin();
+    for (; i!=index.constEnd(); ++i)
+    {
+        order.append(qMakePair(i.value().lastAccess, i.key().id));
+    }
+    std::sort(order.begin(), order.end());
+
+    QList<quint64> evicted;
+    qint64 freed = 0;
+    for (int k=0; k<order.size() && freed < bytesToFree; k++)
+    {
+        tileKey key;
+        key.id = order.at(k).second;
+        {
+            QMutexLocker lock(&cache->evictMutex);
+            if (cache->evictKeep.contains(key))
+            {
+                continue;
+            }
+        }
+        store->remove(key);
+        freed += index.value(key).size;
+        evicted.append(key.id);
+    }
+    QMetaObject::invokeMethod(cache, "slotEvictDone", Qt::QueuedConnection,
+                              Q_ARG(QList<quint64>, evicted));
+}
+
+/**
+* constructor
+* @param _cache disk cache the result is posted to
+* @param _store store to scan
+*/
+diskScanTask::diskScanTask(tileDiskCache *_cache, tileStore *_store)
+{
+    cache = _cache;
+    store = _store;
+}
+
+void diskScanTask::run()
+{
+    tileIndex tiles = store->scan();
+    QMetaObject::invokeMethod(cache, "slotScanDone", Qt::QueuedConnection,
+                              Q_ARG(tileIndex, tiles));
+}
+
+/**
+* constructor
+* @param _cache disk cache the result is posted to
+* @param _indexFile path of the index file
+* @param _storeId location of the store the index belongs to
+* @param _index snapshot of the index
+*/
+diskCompactTask::diskCompactTask(tileDiskCache *_cache, const QString &_indexFile, const QString &_storeId, const tileIndex &_index)
+{
+    cache = _cache;
+    indexFile = _indexFile;
+    storeId = _storeId;
+    index = _index;
+}
+
+void diskCompactTask::run()
+{
+    bool ok = tileDiskCache::writeIndex(indexFile, storeId, index, false);
+    QMetaObject::invokeMethod(cache, "slotCompactDone", Qt::QueuedConnection,
+                              Q_ARG(bool, ok));
+}
+
+/**
+* constructor
+* @param _store store whose tiles are indexed
+*/
+tileDiskCache::tileDiskCache(tileStore *_store, QObject *_parent):QObject(_parent)
+{
+    qRegisterMetaType<QList<quint64> >("QList<quint64>");
+    qRegisterMetaType<tileIndex>("tileIndex");
+    store = _store;
+    cacheSize = 0;
+    cacheMax = CACHE_MAX;
+    evicting = false;
+    scanning = false;
+    compacting = false;
+    journalRecords = 0;
+    pool.setMaxThreadCount(1);
+}
+
+/**
+* destructor, saves the index and waits for the workers so none of them
+* posts to a dead object
+*/
+tileDiskCache::~tileDiskCache()
+{
+    closeIndex();
+    pool.waitForDone();
+}
+
+/**
+* Switches to another %tile store. The index of the old one is saved and
+* running tasks, which still use it, are waited for.
+* The index has to be reset or opened again afterwards.
+*/
+void tileDiskCache::setStore(tileStore *_store)
+{
+    closeIndex();
+    pool.waitForDone();
+    //whatever is still posted belongs to the old store
+    QCoreApplication::removePostedEvents(this, QEvent::MetaCall);
+    evicting = false;
+    evictSnapshot.clear();
+    evictKeep.clear();
+    scanning = false;
+    compacting = false;
+    store = _store;
+}
+
+/**
+* Loads the index saved for a store and keeps it up to date from now on
+* @param file path of the index file
+* @param storeid location of the store, an index saved for another one is ignored
+* @return false if the index was missing, belonged to another store or
+* wasn't closed cleanly. Whatever could be read is loaded anyway and the
+* store should be rescanned.
+* @see tileDiskCache::rescan()
+*/
+bool tileDiskCache::openIndex(const QString &file, const QString &storeid)
+{
+    closeIndex();
+    indexFile = file;
+    storeId = storeid;
+    index.clear();
+    cacheSize = 0;
+    journalRecords = 0;
+    bool valid = readIndex();
+    if (!valid)
+    {
+        //start over with what could be salvaged
+        writeIndex(indexFile, storeId, index, false);
+        journalRecords = 0;
+    }
+    journal.setFileName(indexFile);
+    if (journal.open(QIODevice::ReadWrite))
+    {
+        //it's in use, it's only clean again after closeIndex()
+        journal.seek(INDEX_CLEAN_OFFSET);
+        journal.putChar(0);
+        journal.seek(journal.size());
+        journal.flush();
+    }
+    evict();
+    return valid;
+}
+
+/**
+* Waits for the workers, applies their results and saves the index marked as clean
+*/
+void tileDiskCache::closeIndex()
+{
+    if (indexFile.isEmpty())
+    {
+        return;
+    }
+    do
+    {
+        pool.waitForDone();
+        QCoreApplication::sendPostedEvents(this, QEvent::MetaCall);
+    }
+    while (evicting || scanning || compacting);
+    journal.close();
+    writeIndex(indexFile, storeId, index, true);
+    indexFile.clear();
+    pendingRecords.clear();
+}
+
+/**
+* Reads the index file, replaying all its records
+* @return true if it belongs to the store and was closed cleanly
+*/
+bool tileDiskCache::readIndex()
+{
+    QFile f(indexFile);
+    if (!f.open(QIODevice::ReadOnly))
+    {
+        return false;
+    }
+    QByteArray data = f.readAll();
+    f.close();
+    QDataStream in(data);
+    in.setVersion(QDataStream::Qt_5_0);
+    quint32 magic, version;
+    quint8 clean;
+    QString id;
+    in >> magic >> version >> clean >> id;
+    if (in.status() != QDataStream::Ok || magic != INDEX_MAGIC || version != INDEX_VERSION
+        || id != storeId || !QFileInfo::exists(storeId))
+    {
+        return false;
+    }
+    int records = 0;
+    while (!in.atEnd())
+    {
+        quint8 op;
+        quint64 keyid;
+        diskTile t;
+        in >> op >> keyid >> t.size >> t.lastAccess
+           >> t.fresh.fetched >> t.fresh.expires >> t.fresh.etag >> t.fresh.lastModified;
+        if (in.status() != QDataStream::Ok)
+        {
+            //the last record was cut short
+            clean = 0;
+            break;
+        }
+        tileKey key;
+        key.id = keyid;
+        if (op == INDEX_INSERT)
+        {
+            index.insert(key, t);
+        }
+        else
+        {
+            index.remove(key);
+        }
+        records++;
+    }
+    tileIndex::const_iterator i = index.constBegin();
+    for (; i!=index.constEnd(); ++i)
+    {
+        cacheSize += i.value().size;
+    }
+    journalRecords = records - index.size();
+    return clean != 0;
+}
+
+/**
+* Writes a whole index file, through a temporary file so a crash never leaves it half written
+* @param file path of the index file
+* @param storeid location of the store the index belongs to
+* @param tiles live tiles
+* @param clean true if the file won't be appended to anymore
+* @return true on success
+*/
+bool tileDiskCache::writeIndex(const QString &file, const QString &storeid, const tileIndex &tiles, bool clean)
+{
+    QFile f(file+".tmp");
+    if (!f.open(QIODevice::WriteOnly))
+    {
+        return false;
+    }
+    QDataStream out(&f);
+    out.setVersion(QDataStream::Qt_5_0);
+    out << (quint32)INDEX_MAGIC << (quint32)INDEX_VERSION << (quint8)(clean ? 1 : 0) << storeid;
+    tileIndex::const_iterator i = tiles.constBegin();
+    for (; i!=tiles.constEnd(); ++i)
+    {
+        const diskTile &t = i.value();
+        out << (quint8)INDEX_INSERT << i.key().id << t.size << t.lastAccess
+            << t.fresh.fetched << t.fresh.expires << t.fresh.etag << t.fresh.lastModified;
+    }
+    f.close();
+    if (out.status() != QDataStream::Ok)
+    {
+        QFile::remove(f.fileName());
+        return false;
+    }
+    QFile::remove(file);
+    return QFile::rename(f.fileName(), file);
+}
+
+/**
+* Logs a change to the index file
+*/
+void tileDiskCache::appendRecord(quint8 op, const tileKey &key, const diskTile &t)
+{
+    if (indexFile.isEmpty())
+    {
+        return;
+    }
+    QByteArray record;
+    QDataStream out(&record, QIODevice::WriteOnly);
+    out.setVersion(QDataStream::Qt_5_0);
+    out << op << key.id << t.size << t.lastAccess
+        << t.fresh.fetched << t.fresh.expires << t.fresh.etag << t.fresh.lastModified;
+    journalRecords++;
+    if (compacting)
+    {
+        pendingRecords += record;
+        return;
+    }
+    if (journal.isOpen())
+    {
+        journal.write(record);
+        journal.flush();
+    }
+    if (journalRecords > qMax(INDEX_MIN_COMPACT, 2*index.size()))
+    {
+        compactIndex();
+    }
+}
+
+/**
+* Starts rewriting the index file with only the live tiles.
+* Records logged meanwhile are kept aside and appended when it's done.
+*/
+void tileDiskCache::compactIndex()
+{
+    if (indexFile.isEmpty() || compacting)
+    {
+        return;
+    }
+    compacting = true;
+    journal.close();
+    journalRecords = 0;
+    pool.start(new diskCompactTask(this, indexFile, storeId, index));
+}
+
+/**
+* Called in the GUI thread when the index file has been rewritten
+*/
+void tileDiskCache::slotCompactDone(bool ok)
+{
+    compacting = false;
+    if (!ok)
+    {
+        qDebug() <<"couldn't rewrite the cache index "<<indexFile;
+    }
+    if (journal.open(QIODevice::ReadWrite))
+    {
+        journal.seek(journal.size());
+        journal.write(pendingRecords);
+        journal.flush();
+    }
+    pendingRecords.clear();
+}
+
+/**
+* Rebuilds the index from the store in the background
+* The widget keeps working with what's known meanwhile.
+* @see tileDiskCache::indexReset()
+*/
+void tileDiskCache::rescan()
+{
+    if (scanning)
+    {
+        return;
+    }
+    scanning = true;
+    scanInserted.clear();
+    //the scan runs on a worker, buffered tiles have to be in the store by then
+    store->flush();
+    pool.start(new diskScanTask(this, store));
+}
+
+/**
+* @return true while the store is being rescanned
+*/
+bool tileDiskCache::isScanning() const
+{
+    return scanning;
+}
+
+/**
+* Called in the GUI thread when the rescan is done
+* Access times and freshness already known are kept, as well as tiles
+* written during the scan.
+*/
+void tileDiskCache::slotScanDone(tileIndex tiles)
+{
+    scanning = false;
+    tileIndex::iterator i = tiles.begin();
+    for (; i!=tiles.end(); ++i)
+    {
+        tileIndex::const_iterator known = index.constFind(i.key());
+        if (known != index.constEnd())
+        {
+            i.value().lastAccess = known.value().lastAccess;
+            i.value().fresh = known.value().fresh;
+        }
+    }
+    QSet<tileKey>::const_iterator j = scanInserted.constBegin();
+    for (; j!=scanInserted.constEnd(); ++j)
+    {
+        tileIndex::const_iterator known = index.constFind(*j);
+        if (known != index.constEnd())
+        {
+            tiles.insert(*j, known.value());
+        }
+    }
+    scanInserted.clear();
+    reset(tiles);
+    emit indexReset();
+}
+
+/**
+* Replaces the whole index, e.g. with the result of tileStore::scan()
+* and starts an eviction if it's over budget.
+*/
+void tileDiskCache::reset(const tileIndex &tiles)
+{
+    index = tiles;
+    cacheSize = 0;
+    tileIndex::const_iterator i = index.constBegin();
+    for (; i!=index.constEnd(); ++i)
+    {
+        cacheSize += i.value().size;
+    }
+    compactIndex();
+    evict();
+}
+
+/**
+* @return true if the %tile is stored on disk
+*/
+bool tileDiskCache::contains(const tileKey &key) const
+{
+    return index.contains(key);
+}
+
+/**
+* Marks a %tile as used now, so it's evicted after the ones that weren't
+* @return true if the %tile is stored on disk
+*/
+bool tileDiskCache::touch(const tileKey &key)
+{
+    tileIndex::iterator i = index.find(key);
+    if (i == index.end())
+    {
+        return false;
+    }
+    i.value().lastAccess = QDateTime::currentMSecsSinceEpoch()/1000;
+    keepFromEviction(key);
+    return true;
+}
+
+/**
+* Adds a %tile that was just written to disk
+* @param key %tile
+* @param size size of the file in bytes
+* @param fresh what the server said about reusing it, fetched now if not given
+* @param lastaccess last time the %tile was used, 0 means now
+*/
+void tileDiskCache::insert(const tileKey &key, qint64 size, const tileFreshness &fresh, qint64 lastaccess)
+{
+    qint64 now = QDateTime::currentMSecsSinceEpoch()/1000;
+    diskTile t;
+    t.size = size;
+    t.lastAccess = lastaccess ? lastaccess : now;
+    t.fresh = fresh;
+    if (!t.fresh.fetched)
+    {
+        t.fresh.fetched = now;
+    }
+    tileIndex::iterator i = index.find(key);
+    if (i != index.end())
+    {
+        cacheSize -= i.value().size;
+        i.value() = t;
+    }
+    else
+    {
+        index.insert(key, t);
+    }
+    cacheSize += size;
+    if (scanning)
+    {
+        scanInserted.insert(key);
+    }
+    keepFromEviction(key);
+    appendRecord(INDEX_INSERT, key, t);
+    evict();
+}
+
+/**
+* Updates the freshness of a %tile after the server said it didn't change
+* @return false if the %tile isn't in the index
+*/
+bool tileDiskCache::refresh(const tileKey &key, const tileFreshness &fresh)
+{
+    tileIndex::iterator i = index.find(key);
+    if (i == index.end())
+    {
+        return false;
+    }
+    i.value().fresh = fresh;
+    keepFromEviction(key);
+    appendRecord(INDEX_INSERT, key, i.value());
+    return true;
+}
+
+/**
+* @param key %tile to look up
+* @param fresh receives when it was fetched and how to revalidate it
+* @return false if the %tile isn't in the index
+*/
+bool tileDiskCache::freshness(const tileKey &key, tileFreshness &fresh) const
+{
+    tileIndex::const_iterator i = index.constFind(key);
+    if (i == index.constEnd())
+    {
+        return false;
+    }
+    fresh = i.value().fresh;
+    return true;
+}
+
+/**
+* Takes a %tile out of the index. The file is not touched.
+*/
+void tileDiskCache::remove(const tileKey &key)
+{
+    tileIndex::iterator i = index.find(key);
+    if (i != index.end())
+    {
+        appendRecord(INDEX_REMOVE, key, i.value());
+        cacheSize -= i.value().size;
+        index.erase(i);
+    }
+}
+
+void tileDiskCache::clear()
+{
+    index.clear();
+    cacheSize = 0;
+    compactIndex();
+}
+
+/**
+* @return current %tile cache size in bytes
+*/
+qint64 tileDiskCache::totalSize() const
+{
+    return cacheSize;
+}
+
+/**
+* @return number of tiles on disk
+*/
+int tileDiskCache::count() const
+{
+    return index.size();
+}
+
+/**
+* Sets the maximum space allowed for caching tiles. Lowering it starts an eviction.
+* @param bytes budget in bytes
+*/
+void tileDiskCache::setMaxSize(qint64 bytes)
+{
+    cacheMax = bytes;
+    evict();
+}
+
+qint64 tileDiskCache::maxSize() const
+{
+    return cacheMax;
+}
+
+/**
+* @return true while old tiles are being deleted
+*/
+bool tileDiskCache::isEvicting() const
+{
+    return evicting;
+}
+
+/**
+* Starts deleting the least recently used tiles if the cache is over budget.
+* The index is handed to the worker as an implicitly shared copy,
+* so the GUI thread can keep using and updating it meanwhile.
+*/
+void tileDiskCache::evict()
+{
+    if (evicting || cacheSize <= cacheMax)
+    {
+        return;
+    }
+    evicting = true;
+    qint64 bytes = cacheSize - cacheMax*CACHE_LOW_WATER/100;
+    evictSnapshot = index;
+    pool.start(new diskEvictTask(this, evictSnapshot, bytes, store));
+}
+
+/**
+* Tells a running eviction task to leave a %tile alone
+*/
+void tileDiskCache::keepFromEviction(const tileKey &key)
+{
+    if (!evicting)
+    {
+        return;
+    }
+    QMutexLocker lock(&evictMutex);
+    evictKeep.insert(key);
+}
+
+/**
+* Called in the GUI thread when the eviction task is done
+* Drops the deleted tiles from the index. A %tile that was used or written
+* while the task was already deleting it is only kept if it's still in the
+* store, so the index never lists a file that isn't there.
+*/
+void tileDiskCache::slotEvictDone(QList<quint64> evicted)
+{
+    QSet<tileKey> keep;
+    {
+        QMutexLocker lock(&evictMutex);
+        keep.swap(evictKeep);
+    }
+    QList<tileKey> keys;
+    for (int k=0; k<evicted.size(); k++)
+    {
+        tileKey key;
+        key.id = evicted.at(k);
+        tileIndex::const_iterator now = index.constFind(key);
+        tileIndex::const_iterator then = evictSnapshot.constFind(key);
+        bool changed = keep.contains(key)
+            || (now != index.constEnd() && then != evictSnapshot.constEnd()
+                && (now.value().lastAccess != then.value().lastAccess
+                    || now.value().fresh.fetched != then.value().fresh.fetched));
+        if (changed && now != index.constEnd() && store->contains(key))
+        {
+            continue;
+        }
+        remove(key);
+        keys.append(key);
+    }
+    evictSnapshot.clear();
+    evicting = false;
+    emit tilesEvicted(keys);
+    //tiles downloaded while it was running may have pushed it over again
+    evict();
+}
@@ -0,0 +1,166 @@
+#ifndef TILEDISKCACHE_H
+#define TILEDISKCACHE_H
+
+#include <QObject>
+#include <QRunnable>
+#include <QThreadPool>
+#include <QHash>
+#include <QList>
+#include <QString>
+#include <QSet>
+#include <QFile>
+#include <QMutex>
+#include <QByteArray>
+#include "tilekey.h"
+#include "tilestore.h"
+
+/**
+* maximum space allowed for caching tiles
+*/
+#define CACHE_MAX 100*1024*1024 //100 MB
+/**
+* tiles are evicted until the cache is down to this percentage of the budget,
+* so that an eviction doesn't start again with every new download
+*/
+#define CACHE_LOW_WATER 90
+
+/**
+* contents of the index, what's in the %tile store
+*/
+typedef QHash<tileKey,diskTile> tileIndex;
+
+class tileDiskCache;
+
+/**
+* Picks the least recently used tiles and deletes them from the store on a worker thread
+* @see tileDiskCache
+*/
+class diskEvictTask : public QRunnable
+{
+public:
+    diskEvictTask(tileDiskCache *, const tileIndex &, qint64, tileStore *);
+    void run();
+
+private:
+    tileDiskCache *cache;/**< receives the list of evicted tiles. */
+    tileIndex index;/**< snapshot of the index when the eviction started. */
+    qint64 bytesToFree;/**< how much has to be deleted. */
+    tileStore *store;/**< where the tiles are deleted from. */
+};
+
+/**
+* Walks the whole %tile store on a worker thread to rebuild the index
+* @see tileDiskCache::rescan()
+*/
+class diskScanTask : public QRunnable
+{
+public:
+    diskScanTask(tileDiskCache *, tileStore *);
+    void run();
+
+private:
+    tileDiskCache *cache;/**< receives the tiles found. */
+    tileStore *store;/**< store being scanned. */
+};
+
+/**
+* Rewrites the index file from a snapshot on a worker thread
+* @see tileDiskCache::compactIndex()
+*/
+class diskCompactTask : public QRunnable
+{
+public:
+    diskCompactTask(tileDiskCache *, const QString &, const QString &, const tileIndex &);
+    void run();
+
+private:
+    tileDiskCache *cache;/**< told when the file is ready. */
+    QString indexFile;/**< path of the index file. */
+    QString storeId;/**< location of the store the index belongs to. */
+    tileIndex index;/**< snapshot of the index to write. */
+};
+
+/**
+* Index of the tiles kept in the %tile store
+* Keeps the size, last access time and freshness of every %tile, and when the total size
+* goes over the budget the least recently used tiles are deleted in the
+* background until it's back under CACHE_LOW_WATER percent of the budget.
+*
+* The index is kept in a file next to the store so startup doesn't have to walk
+* the store. The file is a header followed by insert/remove records: every
+* change is appended as it happens and the file is rewritten with only the
+* live tiles (and their access times) when the log grows too long and on exit.
+* If the file is missing, belongs to another store or wasn't closed cleanly,
+* the store is rescanned in the background.
+* @see cacaMap::setDiskCacheSize()
+*/
+class tileDiskCache : public QObject
+{
+    Q_OBJECT
+
+    friend class diskEvictTask;
+    friend class diskScanTask;
+    friend class diskCompactTask;
+
+public:
+    tileDiskCache(tileStore *, QObject *_parent=0);
+    ~tileDiskCache();
+
+    void setStore(tileStore *);
+    void reset(const tileIndex &);
+    bool openIndex(const QString &, const QString &);
+    void closeIndex();
+    void rescan();
+    bool isScanning() const;
+    bool contains(const tileKey &) const;
+    bool touch(const tileKey &);
+    void insert(const tileKey &, qint64, const tileFreshness &fresh=tileFreshness(), qint64 lastaccess=0);
+    bool refresh(const tileKey &, const tileFreshness &);
+    bool freshness(const tileKey &, tileFreshness &) const;
+    void remove(const tileKey &);
+    void clear();
+
+    qint64 totalSize() const;
+    int count() const;
+    void setMaxSize(qint64);
+    qint64 maxSize() const;
+    bool isEvicting() const;
+
+signals:
+    void tilesEvicted(QList<tileKey>);
+    void indexReset();
+
+private:
+    tileIndex index;/**< tiles on disk. */
+    qint64 cacheSize;/**< current %tile cache size in bytes. */
+    qint64 cacheMax;/**< maximum space allowed for caching tiles. */
+    bool evicting;/**< an eviction task is running. */
+    tileIndex evictSnapshot;/**< index as handed to the running eviction task. */
+    QMutex evictMutex;/**< guards evictKeep. */
+    QSet<tileKey> evictKeep;/**< tiles used or written since the eviction started, the task leaves them. */
+    tileStore *store;/**< where the tiles are deleted from. */
+    QThreadPool pool;/**< runs eviction, scans and compaction off the GUI thread, one at a time. */
+
+    QString indexFile;/**< path of the index file, empty if the index isn't persisted. */
+    QString storeId;/**< location of the store, checked when the index is loaded. */
+    QFile journal;/**< index file, open for appending records. */
+    int journalRecords;/**< records appended since the file was last rewritten. */
+    bool compacting;/**< the index file is being rewritten. */
+    QByteArray pendingRecords;/**< records appended while the file is being rewritten. */
+    bool scanning;/**< the store is being rescanned. */
+    QSet<tileKey> scanInserted;/**< tiles added while the store was being scanned. */
+
+    void evict();
+    void keepFromEviction(const tileKey &);
+    bool readIndex();
+    void appendRecord(quint8, const tileKey &, const diskTile &);
+    void compactIndex();
+    static bool writeIndex(const QString &, const QString &, const tileIndex &, bool);
+
+private slots:
+    void slotEvictDone(QList<quint64>);
+    void slotScanDone(tileIndex);
+    void slotCompactDone(bool);
+};
+
+#endif
@@ -0,0 +1,788 @@
+#include "tiledownloader.h"
+#include <QUrl>
+#include <QNetworkRequest>
+#include <QDebug>
+#include <QVector>
+#include <QPair>
+#include <QDateTime>
+#include <QLocale>
+#include <QHostAddress>
+#include <QRandomGenerator>
+#include <QtMath>
+#include <algorithm>
+
+/**
+* constructor
+*/
+tileDownloader::tileDownloader(QObject *_parent):QObject(_parent)
+{
+    maxDownloads = 8;
+    maxHostDownloads = 6;
+    hasViewport = false;
+    viewZoom = 0;
+    staleMargin = 1;
+    prefetchesInFlight = 0;
+    maxPrefetchDownloads = 2;
+    maxRetryCount = 4;
+    retryBaseDelay = 1000;
+    retryMaxDelay = 60*1000;
+    breakerThreshold = 5;
+    breakerCooldown = 30*1000;
+    retryTimer.setSingleShot(true);
+    connect(&retryTimer, SIGNAL(timeout()),this, SLOT(slotRetryTimeout()));
+    manager = new QNetworkAccessManager(this);
+    manager->setStrictTransportSecurityEnabled(false);
+    manager->setRedirectPolicy(QNetworkRequest::SameOriginRedirectPolicy);
+    //one hookup for all the replies
+    connect(manager, SIGNAL(finished(QNetworkReply*)),this, SLOT(slotDownloadReady(QNetworkReply*)));
+}
+
+/**
+* destructor
+*/
+tileDownloader::~tileDownloader()
+{
+    delete manager;
+}
+
+/**
+* Adds a %tile to the download queue
+* @param key %tile to download
+* @param url where the %tile image can be found
+*/
+void tileDownloader::enqueue(const tileKey &key, const QString &url)
+{
+    if (!activeDownloads.contains(key))
+    {
+        downloadQueue.insert(key, url);
+        revalidations.remove(key);
+        //it's on screen now
+        prefetches.remove(key);
+    }
+}
+
+/**
+* Queues a conditional request for a cached %tile past its expiry
+* tileNotModified() is emitted if the server says it didn't change,
+* tileReady() with the new image otherwise.
+* @param key %tile to revalidate
+* @param url where the %tile image can be found
+* @param fresh validators saved when the %tile was fetched
+*/
+void tileDownloader::revalidate(const tileKey &key, const QString &url, const tileFreshness &fresh)
+{
+    if (!activeDownloads.contains(key) && !downloadQueue.contains(key))
+    {
+        downloadQueue.insert(key, url);
+        revalidations.insert(key, fresh);
+    }
+}
+
+/**
+* Queues a %tile that isn't on screen yet but probably will be soon
+* Prefetches aren't dropped by setViewport(), the caller replaces them
+* with clearPrefetch() as the view moves.
+* @param key %tile to download
+* @param url where the %tile image can be found
+*/
+void tileDownloader::prefetch(const tileKey &key, const QString &url)
+{
+    if (!activeDownloads.contains(key) && !downloadQueue.contains(key))
+    {
+        downloadQueue.insert(key, url);
+        prefetches.insert(key);
+    }
+}
+
+/**
+* @return true if the %tile is queued or downloading as a prefetch
+*/
+bool tileDownloader::isPrefetch(const tileKey &key) const
+{
+    return prefetches.contains(key);
+}
+
+/**
+* Drops the queued prefetches. Those in flight are left to finish.
+*/
+void tileDownloader::clearPrefetch()
+{
+    QSet<tileKey>::iterator i = prefetches.begin();
+    while (i != prefetches.end())
+    {
+        if (downloadQueue.remove(*i))
+        {
+            i = prefetches.erase(i);
+        }
+        else
+        {
+            ++i;
+        }
+    }
+}
+
+/**
+* @return true if the %tile is queued or downloading
+*/
+bool tileDownloader::contains(const tileKey &key) const
+{
+    return downloadQueue.contains(key) || activeDownloads.contains(key);
+}
+
+/**
+* Drops the tiles waiting in the queue. Requests in flight are left to finish.
+*/
+void tileDownloader::clearQueue()
+{
+    QHash<tileKey,QString>::const_iterator i = downloadQueue.constBegin();
+    for (; i!=downloadQueue.constEnd(); ++i)
+    {
+        revalidations.remove(i.key());
+        prefetches.remove(i.key());
+    }
+    downloadQueue.clear();
+}
+
+/**
+* Starts downloading queued tiles until the concurrency limits are reached
+* The tiles closest to the center of the viewport go first, prefetches only
+* when none of those is left waiting for a free slot. Tiles still backing off
+* and servers that are paused are skipped, and a timer is set for when the
+* first of them can go.
+*/
+void tileDownloader::startDownloads()
+{
+    if (activeDownloads.size() >= maxDownloads || downloadQueue.isEmpty())
+    {
+        return;
+    }
+    QVector<QPair<qreal,quint64> > order;
+    QVector<QPair<qreal,quint64> > prefetchOrder;
+    order.reserve(downloadQueue.size());
+    QHash<tileKey,QString>::const_iterator i = downloadQueue.constBegin();
+    for (; i!=downloadQueue.constEnd(); ++i)
+    {
+        if (prefetches.contains(i.key()))
+        {
+            prefetchOrder.append(qMakePair(priority(i.key()), i.key().id));
+        }
+        else
+        {
+            order.append(qMakePair(priority(i.key()), i.key().id));
+        }
+    }
+    std::sort(order.begin(), order.end());
+    std::sort(prefetchOrder.begin(), prefetchOrder.end());
+
+    qint64 now = QDateTime::currentMSecsSinceEpoch();
+    qint64 wakeup = 0;
+    bool waiting = startRequests(order, false, now, wakeup);
+    //prefetching yields to the tiles on screen
+    if (!waiting && !prefetchOrder.isEmpty())
+    {
+        startRequests(prefetchOrder, true, now, wakeup);
+    }
+    if (wakeup)
+    {
+        scheduleRetry(wakeup, now);
+    }
+}
+
+/**
+* Starts the requests of a list of queued tiles, in order
+* @param order priority and id of the tiles, sorted
+* @param prefetch true if they are prefetches, which have their own budget
+* @param now current time in ms since epoch
+* @param wakeup set to the earliest time a skipped %tile can go, if it's earlier
+* @return true if some %tile was left waiting for a free slot
+*/
+bool tileDownloader::startRequests(const QVector<QPair<qreal,quint64> > &order, bool prefetch, qint64 now, qint64 &wakeup)
+{
+    bool waiting = false;
+    for (int k=0; k<order.size(); k++)
+    {
+        if (activeDownloads.size() >= maxDownloads
+            || (prefetch && prefetchesInFlight >= maxPrefetchDownloads))
+        {
+            return true;
+        }
+        tileKey key;
+        key.id = order.at(k).second;
+        QHash<tileKey,tileRetry>::const_iterator r = retries.constFind(key);
+        if (r != retries.constEnd() && r.value().notBefore > now)
+        {
+            wakeup = wakeup ? qMin(wakeup, r.value().notBefore) : r.value().notBefore;
+            continue;
+        }
+        QString surl = downloadQueue.value(key);
+        QUrl url(surl);
+        int &hostcount = hostDownloads[url.host()];
+        if (hostcount >= maxHostDownloads)
+        {
+            waiting = true;
+            continue;
+        }
+        if (!hostAvailable(url.host(), now))
+        {
+            qint64 until = hosts.value(serverOf(url.host())).openUntil;
+            if (until > now)
+            {
+                wakeup = wakeup ? qMin(wakeup, until) : until;
+            }
+            continue;
+        }
+        hostcount++;
+        QNetworkRequest request;
+        request.setUrl(url);
+        request.setAttribute(QNetworkRequest::Http2AllowedAttribute, true);
+        //the reply finds its tile through this, whatever the final url is
+        request.setAttribute(QNetworkRequest::User, QVariant(key.id));
+        QHash<tileKey,tileFreshness>::const_iterator v = revalidations.constFind(key);
+        if (v != revalidations.constEnd())
+        {
+            if (!v.value().etag.isEmpty())
+            {
+                request.setRawHeader("If-None-Match", v.value().etag);
+            }
+            if (!v.value().lastModified.isEmpty())
+            {
+                request.setRawHeader("If-Modified-Since", v.value().lastModified);
+            }
+        }
+        if (prefetch)
+        {
+            request.setPriority(QNetworkRequest::LowPriority);
+            prefetchesInFlight++;
+        }
+        activeReplies.insert(key, manager->get(request));
+        activeDownloads.insert(key, surl);
+        downloadQueue.remove(key);
+    }
+    return waiting;
+}
+
+/**
+* Tells the downloader what is being displayed
+* Queued tiles that are no longer relevant are dropped and the requests
+* in flight for them are aborted, so the bandwidth goes to the visible tiles.
+* @param zoom zoom level being displayed
+* @param center center of the viewport in %tile units (px/tilesize)
+* @param halfsize half the width and height of the viewport in %tile units
+*/
+void tileDownloader::setViewport(int zoom, QPointF center, QSizeF halfsize)
+{
+    hasViewport = true;
+    viewZoom = zoom;
+    viewCenter = center;
+    viewHalfSize = halfsize;
+
+    QHash<tileKey,QString>::iterator i = downloadQueue.begin();
+    while (i != downloadQueue.end())
+    {
+        if (isRelevant(i.key()) || prefetches.contains(i.key()))
+        {
+            ++i;
+        }
+        else
+        {
+            revalidations.remove(i.key());
+            i = downloadQueue.erase(i);
+        }
+    }
+
+    //aborting emits finished() right away, which changes activeDownloads
+    QList<QNetworkReply*> stale;
+    QHash<tileKey,QString>::const_iterator j = activeDownloads.constBegin();
+    for (; j!=activeDownloads.constEnd(); ++j)
+    {
+        if (!isRelevant(j.key()) && !prefetches.contains(j.key()))
+        {
+            stale.append(activeReplies.value(j.key()));
+        }
+    }
+    for (int k=0; k<stale.size(); k++)
+    {
+        stale.at(k)->abort();
+    }
+
+    //forget the failures of tiles that went out of view once their backoff is over
+    qint64 now = QDateTime::currentMSecsSinceEpoch();
+    QHash<tileKey,tileRetry>::iterator r = retries.begin();
+    while (r != retries.end())
+    {
+        if (r.value().notBefore <= now && !isRelevant(r.key()))
+        {
+            r = retries.erase(r);
+        }
+        else
+        {
+            ++r;
+        }
+    }
+}
+
+/**
+* Sets how many tiles outside the viewport are still worth downloading
+* @param margin margin around the viewport in tiles
+*/
+void tileDownloader::setStaleMargin(int margin)
+{
+    staleMargin = qMax(0, margin);
+}
+
+/**
+* @return download priority of a %tile, lower goes first.
+* It's the squared distance to the center of the viewport, tiles from other
+* zoom levels go after all the tiles of the displayed one.
+*/
+qreal tileDownloader::priority(const tileKey &key) const
+{
+    if (!hasViewport)
+    {
+        return 0;
+    }
+    int zoom = key.zoom();
+    qreal numtiles = (qreal)((qint64)1<<zoom);
+    //center of the viewport in tiles of the key's zoom level
+    qreal scale = qPow(2.0, zoom - viewZoom);
+    //the map wraps around horizontally
+    qreal dx = qAbs(key.x() + 0.5 - viewCenter.x()*scale);
+    dx = qMin(dx, numtiles - dx);
+    qreal dy = key.y() + 0.5 - viewCenter.y()*scale;
+    qreal d = dx*dx + dy*dy;
+    if (zoom != viewZoom)
+    {
+        d += numtiles*numtiles;
+    }
+    //the stale tile is on screen already
+    if (revalidations.contains(key))
+    {
+        d += 2*numtiles*numtiles;
+    }
+    return d;
+}
+
+/**
+* @return true if the %tile is displayed or close enough to the viewport
+*/
+bool tileDownloader::isRelevant(const tileKey &key) const
+{
+    if (!hasViewport)
+    {
+        return true;
+    }
+    int zoom = key.zoom();
+    if (zoom != viewZoom)
+    {
+        return false;
+    }
+    qreal numtiles = (qreal)((qint64)1<<zoom);
+    qreal dx = qAbs(key.x() + 0.5 - viewCenter.x());
+    dx = qMin(dx, numtiles - dx);
+    qreal dy = qAbs(key.y() + 0.5 - viewCenter.y());
+    return dx <= viewHalfSize.width() + 0.5 + staleMargin
+        && dy <= viewHalfSize.height() + 0.5 + staleMargin;
+}
+
+/**
+* @return number of tiles waiting to be downloaded
+*/
+int tileDownloader::queued() const
+{
+    return downloadQueue.size();
+}
+
+/**
+* @return number of requests in flight
+*/
+int tileDownloader::inFlight() const
+{
+    return activeDownloads.size();
+}
+
+/**
+* Sets the maximum number of requests in flight
+*/
+void tileDownloader::setMaxConcurrent(int downloads)
+{
+    maxDownloads = qMax(1, downloads);
+    startDownloads();
+}
+
+int tileDownloader::maxConcurrent() const
+{
+    return maxDownloads;
+}
+
+/**
+* Sets the maximum number of requests in flight to a single tile server
+*/
+void tileDownloader::setMaxPerHost(int downloads)
+{
+    maxHostDownloads = qMax(1, downloads);
+    startDownloads();
+}
+
+int tileDownloader::maxPerHost() const
+{
+    return maxHostDownloads;
+}
+
+/**
+* Sets the maximum number of prefetch requests in flight
+* @param downloads 0 disables prefetching
+*/
+void tileDownloader::setMaxPrefetches(int downloads)
+{
+    maxPrefetchDownloads = qMax(0, downloads);
+    startDownloads();
+}
+
+int tileDownloader::maxPrefetches() const
+{
+    return maxPrefetchDownloads;
+}
+
+/**
+* Sets how many times a %tile is retried after a transient failure
+* before tileFailed() is emitted for it
+*/
+void tileDownloader::setMaxRetries(int retries)
+{
+    maxRetryCount = qMax(0, retries);
+}
+
+int tileDownloader::maxRetries() const
+{
+    return maxRetryCount;
+}
+
+/**
+* Sets the backoff between retries of a failed %tile
+* @param basems wait after the first failure, doubled with each failure
+* @param maxms longest wait
+*/
+void tileDownloader::setRetryDelay(int basems, int maxms)
+{
+    retryBaseDelay = qMax(1, basems);
+    retryMaxDelay = qMax(retryBaseDelay, maxms);
+}
+
+/**
+* Sets when a failing tile server is paused
+* @param failures consecutive failures that get the server paused
+* @param cooldownms how long it's first paused, doubled each time it's still down
+*/
+void tileDownloader::setCircuitBreaker(int failures, int cooldownms)
+{
+    breakerThreshold = qMax(1, failures);
+    breakerCooldown = qMax(1, cooldownms);
+}
+
+/**
+* @return true if the server failed too many times in a row and is paused
+* @param host any of the server's hosts, subdomains share one breaker
+*/
+bool tileDownloader::isHostDown(const QString &host) const
+{
+    QHash<QString,hostHealth>::const_iterator h = hosts.constFind(serverOf(host));
+    return h != hosts.constEnd() && h.value().failures >= breakerThreshold;
+}
+
+/**
+* @return how long to wait before the next attempt of a %tile, in ms
+* Exponential in the number of failures, half of it random so that
+* the tiles failing together don't all come back at the same time.
+*/
+qint64 tileDownloader::backoff(int attempts) const
+{
+    qint64 delay = (qint64)retryBaseDelay << qMin(attempts-1, 20);
+    delay = qMin(delay, (qint64)retryMaxDelay);
+    return delay/2 + QRandomGenerator::global()->bounded((int)(delay/2) + 1);
+}
+
+/**
+* @return true if a request can be sent to the server now
+* Once a paused server has cooled down a single probe request is let through.
+*/
+bool tileDownloader::hostAvailable(const QString &host, qint64 now)
+{
+    QHash<QString,hostHealth>::iterator h = hosts.find(serverOf(host));
+    if (h == hosts.end() || h.value().failures < breakerThreshold)
+    {
+        return true;
+    }
+    if (h.value().probing || now < h.value().openUntil)
+    {
+        return false;
+    }
+    h.value().probing = true;
+    return true;
+}
+
+/**
+* The server answered, it's not failing anymore
+*/
+void tileDownloader::hostSucceeded(const QString &host)
+{
+    QString server = serverOf(host);
+    QHash<QString,hostHealth>::iterator h = hosts.find(server);
+    if (h == hosts.end())
+    {
+        return;
+    }
+    bool wasdown = h.value().failures >= breakerThreshold;
+    hosts.erase(h);
+    if (wasdown)
+    {
+        qDebug() <<"tile server "<<server<<" is back";
+        emit hostUp(server);
+    }
+}
+
+/**
+* Counts a transient failure of the server, pausing it if there are too many
+*/
+void tileDownloader::hostFailed(const QString &host, qint64 now)
+{
+    QString server = serverOf(host);
+    QHash<QString,hostHealth>::iterator h = hosts.find(server);
+    if (h == hosts.end())
+    {
+        hostHealth health = {0, 0, breakerCooldown, false};
+        h = hosts.insert(server, health);
+    }
+    hostHealth &health = h.value();
+    health.failures++;
+    if (health.probing || health.failures == breakerThreshold)
+    {
+        bool wasdown = health.probing;
+        health.openUntil = now + health.cooldown;
+        health.cooldown = qMin(health.cooldown*2, (qint64)10*60*1000);
+        health.probing = false;
+        if (!wasdown)
+        {
+            qDebug() <<"tile server "<<server<<" is down, pausing requests";
+            emit hostDown(server);
+        }
+    }
+}
+
+/**
+* @return the server a host belongs to, for the circuit breaker
+* Tile servers spread over subdomains (a.tile.example.org, b.tile...) are
+* one server, so the first label is dropped from names with more than two.
+* IP addresses are kept as they are.
+*/
+QString tileDownloader::serverOf(const QString &host)
+{
+    if (!QHostAddress(host).isNull() || host.count('.') < 2)
+    {
+        return host;
+    }
+    return host.mid(host.indexOf('.') + 1);
+}
+
+/**
+* Makes sure startDownloads() runs again at a given time
+* @param when time in ms since epoch
+* @param now current time in ms since epoch
+*/
+void tileDownloader::scheduleRetry(qint64 when, qint64 now)
+{
+    int wait = (int)qMax((qint64)0, when - now);
+    if (!retryTimer.isActive() || retryTimer.remainingTime() > wait)
+    {
+        retryTimer.start(wait);
+    }
+}
+
+/**
+* @return true if the failure may go away by trying again later
+* @param error error of the reply
+* @param status http status code, 0 if the server didn't answer
+*/
+bool tileDownloader::isTransient(QNetworkReply::NetworkError error, int status)
+{
+    if (status)
+    {
+        return status >= 500 || status == 429 || status == 408 || error == QNetworkReply::NoError;
+    }
+    return error != QNetworkReply::OperationCanceledError;
+}
+
+/**
+* Reads what the server said about reusing the %tile
+* max-age in Cache-Control wins over Expires. no-cache and no-store make it
+* stale right away: it's still kept for offline use, just revalidated every time.
+* @param reply finished reply
+* @param old freshness sent with a revalidation, its validators are kept
+* if a 304 doesn't repeat them
+* @return freshness of the %tile, fetched now
+*/
+tileFreshness tileDownloader::freshness(QNetworkReply *reply, const tileFreshness &old)
+{
+    tileFreshness fresh;
+    fresh.fetched = QDateTime::currentMSecsSinceEpoch()/1000;
+    fresh.etag = reply->rawHeader("ETag");
+    fresh.lastModified = reply->rawHeader("Last-Modified");
+    if (!fresh.hasValidators())
+    {
+        fresh.etag = old.etag;
+        fresh.lastModified = old.lastModified;
+    }
+
+    QList<QByteArray> directives = reply->rawHeader("Cache-Control").toLower().split(',');
+    for (int k=0; k<directives.size(); k++)
+    {
+        QByteArray d = directives.at(k).trimmed();
+        if (d == "no-cache" || d == "no-store")
+        {
+            fresh.expires = fresh.fetched;
+            return fresh;
+        }
+        if (d.startsWith("max-age="))
+        {
+            bool ok;
+            qint64 maxage = d.mid(8).toLongLong(&ok);
+            if (ok)
+            {
+                //time it already spent in intermediate caches
+                qint64 age = reply->rawHeader("Age").toLongLong();
+                fresh.expires = fresh.fetched + qMax((qint64)0, maxage - age);
+                return fresh;
+            }
+        }
+    }
+
+    QByteArray expires = reply->rawHeader("Expires");
+    if (!expires.isEmpty())
+    {
+        QDateTime date = QLocale::c().toDateTime(QString::fromLatin1(expires.trimmed()),
+                                                 "ddd, dd MMM yyyy hh:mm:ss 'GMT'");
+        date.setTimeSpec(Qt::UTC);
+        //an unparseable date means already expired
+        fresh.expires = date.isValid() ? qMax((qint64)1, date.toMSecsSinceEpoch()/1000) : fresh.fetched;
+    }
+    return fresh;
+}
+
+void tileDownloader::slotRetryTimeout()
+{
+    startDownloads();
+}
+
+/**
+* Slot that gets called everytime a %tile download request finishes
+* Takes the %tile out of the active list and reports the result, or puts it
+* back in the queue to be retried after a backoff if the failure looks
+* transient. Then starts the next queued download.
+*/
+void tileDownloader::slotDownloadReady(QNetworkReply *_reply)
+{
+    QNetworkReply::NetworkError error = _reply->error();
+    QNetworkRequest req = _reply->request();
+    QString host = req.url().host();
+    hostDownloads[host]--;
+
+    tileKey key;
+    key.id = req.attribute(QNetworkRequest::User).toULongLong();
+    QHash<tileKey,QString>::iterator i = activeDownloads.find(key);
+    bool found = i != activeDownloads.end();
+
+    if (found)
+    {
+        QString url = i.value();
+        activeDownloads.erase(i);
+        activeReplies.remove(key);
+        if (prefetches.contains(key))
+        {
+            prefetchesInFlight--;
+        }
+        QByteArray data;
+        if (error == QNetworkReply::NoError)
+        {
+            data = _reply->readAll();
+        }
+        int status = _reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+        //the validators are only needed until the request is done or dropped
+        tileFreshness old = revalidations.value(key);
+        bool revalidating = revalidations.contains(key);
+        if (error == QNetworkReply::NoError && revalidating && status == 304)
+        {
+            revalidations.remove(key);
+            retries.remove(key);
+            hostSucceeded(host);
+            emit tileNotModified(key, freshness(_reply, old));
+        }
+        else if (error == QNetworkReply::NoError && data.size())
+        {
+            revalidations.remove(key);
+            retries.remove(key);
+            hostSucceeded(host);
+            emit tileReady(key, data, freshness(_reply, old));
+        }
+        else if (error == QNetworkReply::OperationCanceledError)
+        {
+            //aborted because it went out of view, not the server's fault
+            QHash<QString,hostHealth>::iterator h = hosts.find(serverOf(host));
+            if (h != hosts.end())
+            {
+                h.value().probing = false;
+            }
+            revalidations.remove(key);
+            emit tileFailed(key, error);
+        }
+        else if (isTransient(error, status))
+        {
+            qDebug() <<"network error: ("<<error<<") "<<_reply->errorString();
+            qint64 now = QDateTime::currentMSecsSinceEpoch();
+            hostFailed(host, now);
+            QHash<tileKey,tileRetry>::iterator r = retries.find(key);
+            if (r == retries.end())
+            {
+                tileRetry retry = {0, 0};
+                r = retries.insert(key, retry);
+            }
+            tileRetry &retry = r.value();
+            retry.attempts++;
+            qint64 delay = backoff(retry.attempts);
+            //the server may tell how long to stay away (429, 503)
+            bool ok;
+            int retryafter = _reply->rawHeader("Retry-After").toInt(&ok);
+            if (ok)
+            {
+                delay = qMax(delay, (qint64)retryafter*1000);
+            }
+            retry.notBefore = now + delay;
+            if (retry.attempts <= maxRetryCount && isRelevant(key))
+            {
+                downloadQueue.insert(key, url);
+            }
+            else
+            {
+                //given up for now, enqueueing it again still waits for the backoff
+                revalidations.remove(key);
+                emit tileFailed(key, error);
+            }
+        }
+        else
+        {
+            //the server answered, it just doesn't have it
+            revalidations.remove(key);
+            retries.remove(key);
+            hostSucceeded(host);
+            emit tileFailed(key, error);
+        }
+        if (!downloadQueue.contains(key))
+        {
+            prefetches.remove(key);
+        }
+    }
+    else
+    {
+        qDebug() <<"downloaded tile "<<req.url().toString()<<" was not in Download queue. Data ignored";
+    }
+    _reply->deleteLater();
+    startDownloads();
+}
@@ -0,0 +1,142 @@
+#ifndef TILEDOWNLOADER_H
+#define TILEDOWNLOADER_H
+
+#include <QObject>
+#include <QHash>
+#include <QString>
+#include <QByteArray>
+#include <QPointF>
+#include <QSizeF>
+#include <QTimer>
+#include <QSet>
+#include <QVector>
+#include <QPair>
+#include "tilekey.h"
+#include "tilefreshness.h"
+#include <QNetworkAccessManager>
+#include <QNetworkReply>
+
+/**
+* Retry state of a %tile whose download failed
+*/
+struct tileRetry
+{
+    int attempts;/**< consecutive failed attempts. */
+    qint64 notBefore;/**< earliest time of the next attempt, in ms since epoch. */
+};
+
+/**
+* Health of a tile server, used as a circuit breaker
+* After too many consecutive failures the server is left alone for a while,
+* then a single request probes whether it's back.
+*/
+struct hostHealth
+{
+    int failures;/**< consecutive failed requests. */
+    qint64 openUntil;/**< no requests are sent before this time, in ms since epoch. */
+    qint64 cooldown;/**< how long the server is left alone the next time it trips, in ms. */
+    bool probing;/**< the probe request is in flight. */
+};
+
+/**
+* Downloads tiles with several requests in flight at once
+* All requests go through a single QNetworkAccessManager so connections
+* to the tile servers are kept alive and reused.
+* Queued tiles are started closest to the center of the viewport first,
+* tiles that scroll out of view or belong to another zoom level are dropped.
+* Transient failures (timeouts, connection errors, 5xx, 429) are retried with
+* exponential backoff and jitter, and a server that keeps failing is paused
+* altogether until a probe request succeeds.
+* Cached tiles past their expiry can be revalidated with conditional requests,
+* they go after the tiles that aren't cached at all.
+* Prefetched tiles have a small budget of their own and are only started
+* when no tile on screen is waiting.
+* @see cacaMap::setMaxConcurrentDownloads()
+*/
+class tileDownloader : public QObject
+{
+    Q_OBJECT
+
+public:
+    tileDownloader(QObject *_parent=0);
+    ~tileDownloader();
+
+    void enqueue(const tileKey &, const QString &);
+    void revalidate(const tileKey &, const QString &, const tileFreshness &);
+    void prefetch(const tileKey &, const QString &);
+    bool isPrefetch(const tileKey &) const;
+    void clearPrefetch();
+    bool contains(const tileKey &) const;
+    void clearQueue();
+    void startDownloads();
+    void setViewport(int, QPointF, QSizeF);
+    void setStaleMargin(int);
+
+    int queued() const;
+    int inFlight() const;
+
+    void setMaxConcurrent(int);
+    int maxConcurrent() const;
+    void setMaxPerHost(int);
+    int maxPerHost() const;
+
+    void setMaxPrefetches(int);
+    int maxPrefetches() const;
+
+    void setMaxRetries(int);
+    int maxRetries() const;
+    void setRetryDelay(int, int);
+    void setCircuitBreaker(int, int);
+    bool isHostDown(const QString &) const;
+
+signals:
+    void tileReady(tileKey, QByteArray, tileFreshness);
+    void tileNotModified(tileKey, tileFreshness);
+    void tileFailed(tileKey, QNetworkReply::NetworkError);
+    void hostDown(QString);
+    void hostUp(QString);
+
+private:
+    QNetworkAccessManager *manager;/**< manages http requests. */
+    QHash<tileKey,QString> downloadQueue;/**< urls of the tiles waiting to be downloaded. */
+    QHash<tileKey,QString> activeDownloads;/**< urls of the tiles with a request in flight. */
+    QHash<QString,int> hostDownloads;/**< number of requests in flight per host. */
+    int maxDownloads;/**< maximum number of requests in flight. */
+    int maxHostDownloads;/**< maximum number of requests in flight to the same host. */
+    QHash<tileKey,QNetworkReply*> activeReplies;/**< replies of the tiles in flight, used to abort them. */
+    QHash<tileKey,tileFreshness> revalidations;/**< validators of the queued or in flight tiles that are already cached. */
+    QSet<tileKey> prefetches;/**< queued or in flight tiles that aren't on screen yet. */
+    int prefetchesInFlight;/**< number of prefetch requests in flight. */
+    int maxPrefetchDownloads;/**< maximum number of prefetch requests in flight. */
+    bool hasViewport;/**< false until setViewport() is called, everything is relevant then. */
+    int viewZoom;/**< zoom level currently displayed. */
+    QPointF viewCenter;/**< center of the viewport in %tile units. */
+    QSizeF viewHalfSize;/**< half the size of the viewport in %tile units. */
+    int staleMargin;/**< tiles this far outside the viewport are still kept. */
+    QHash<tileKey,tileRetry> retries;/**< tiles whose last download failed. */
+    QHash<QString,hostHealth> hosts;/**< servers that failed lately, by serverOf() their host. */
+    QTimer retryTimer;/**< restarts the downloads when the next backoff is over. */
+    int maxRetryCount;/**< attempts after the first before a %tile is reported as failed. */
+    int retryBaseDelay;/**< backoff after the first failure in ms, doubled with each failure. */
+    int retryMaxDelay;/**< longest backoff in ms. */
+    int breakerThreshold;/**< consecutive failures that get a server paused. */
+    int breakerCooldown;/**< how long a server is first paused in ms, doubled each time the probe fails. */
+
+    qreal priority(const tileKey &) const;
+    bool startRequests(const QVector<QPair<qreal,quint64> > &, bool, qint64, qint64 &);
+    bool isRelevant(const tileKey &) const;
+    qint64 backoff(int) const;
+    bool hostAvailable(const QString &, qint64);
+    void hostSucceeded(const QString &);
+    void hostFailed(const QString &, qint64);
+    void scheduleRetry(qint64, qint64);
+    static bool isTransient(QNetworkReply::NetworkError, int);
+    static QString serverOf(const QString &);
+    static tileFreshness freshness(QNetworkReply *, const tileFreshness &);
+
+private slots:
+    void slotDownloadReady(QNetworkReply *);
+    void slotRetryTimeout();
+};
+
+#endif
@@ -0,0 +1,47 @@
+#ifndef TILEFRESHNESS_H
+#define TILEFRESHNESS_H
+
+#include <QtGlobal>
+#include <QByteArray>
+#include <QMetaType>
+
+/**
+* how long a %tile is considered fresh when the server didn't say
+*/
+#define FRESHNESS_DEFAULT 7*24*3600 //a week
+
+/**
+* What the tile server said about reusing a downloaded %tile
+* Tiles past their expiry are still displayed, they are just revalidated
+* with a conditional request (If-None-Match / If-Modified-Since).
+*/
+struct tileFreshness
+{
+    qint64 fetched;/**< when the %tile was downloaded or last revalidated, in seconds since epoch. */
+    qint64 expires;/**< the server allows reusing it without asking until then, 0 if unknown. */
+    QByteArray etag;/**< ETag header of the last response. */
+    QByteArray lastModified;/**< Last-Modified header of the last response. */
+
+    tileFreshness(): fetched(0), expires(0) {}
+
+    /**
+    * @return true if the server has to be asked before reusing the %tile
+    * @param now current time in seconds since epoch
+    */
+    bool isStale(qint64 now) const
+    {
+        return now >= (expires ? expires : fetched + FRESHNESS_DEFAULT);
+    }
+
+    /**
+    * @return true if a conditional request can be made
+    */
+    bool hasValidators() const
+    {
+        return !etag.isEmpty() || !lastModified.isEmpty();
+    }
+};
+
+Q_DECLARE_METATYPE(tileFreshness)
+
+#endif
@@ -0,0 +1,92 @@
+#ifndef TILEKEY_H
+#define TILEKEY_H
+
+#include <QtGlobal>
+#include <QHash>
+#include <QtAlgorithms>
+
+/**
+* Identifies a %tile by zoom level, column and row packed in a single integer.
+* The layout is a marker bit at position 2*zoom followed by the x and y bits,
+* so keys are unique across zoom levels up to zoom 31 and sort by zoom first.
+* Keys are cheap to build, compare and hash, paths and urls are only
+* formatted from them when a %tile is actually read, written or downloaded.
+*/
+struct tileKey
+{
+    quint64 id;/**< packed zoom, x and y. 0 is not a valid %tile. */
+
+    tileKey()
+    {
+        id = 0;
+    }
+
+    tileKey(int zoom, quint32 x, quint32 y)
+    {
+        id = ((quint64)1<<(2*zoom)) | ((quint64)x<<zoom) | (quint64)y;
+    }
+
+    int zoom() const
+    {
+        return (63 - qCountLeadingZeroBits(id))/2;
+    }
+
+    quint32 x() const
+    {
+        int z = zoom();
+        return (quint32)((id>>z) & (((quint64)1<<z) - 1));
+    }
+
+    quint32 y() const
+    {
+        return (quint32)(id & (((quint64)1<<zoom()) - 1));
+    }
+
+    /**
+    * @return key of the %tile one zoom level up that contains this one
+    */
+    tileKey parent() const
+    {
+        return tileKey(zoom() - 1, x()/2, y()/2);
+    }
+
+    /**
+    * @return key of one of the four tiles one zoom level down that this one contains
+    * @param quadrant 0 top left, 1 top right, 2 bottom left, 3 bottom right
+    */
+    tileKey child(int quadrant) const
+    {
+        return tileKey(zoom() + 1, 2*x() + (quadrant & 1), 2*y() + (quadrant>>1));
+    }
+
+    bool isValid() const
+    {
+        return id != 0;
+    }
+
+    bool operator==(const tileKey &other) const
+    {
+        return id == other.id;
+    }
+
+    bool operator!=(const tileKey &other) const
+    {
+        return id != other.id;
+    }
+
+    bool operator<(const tileKey &other) const
+    {
+        return id < other.id;
+    }
+};
+
+#if QT_VERSION >= QT_VERSION_CHECK(6,0,0)
+inline size_t qHash(const tileKey &key, size_t seed = 0)
+#else
+inline uint qHash(const tileKey &key, uint seed = 0)
+#endif
+{
+    return qHash(key.id, seed);
+}
+
+#endif
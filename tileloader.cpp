@@ -0,0 +1,248 @@
+#include "tileloader.h"
+#include <QThread>
+#include <QPainter>
+#include <QBuffer>
+
+/**
+* constructor
+* @param _loader loader the result is posted to
+* @param _key %tile to load
+* @param _store where the %tile is read from
+* @param _generation current loader generation
+* @param _data encoded %tile, it's read from the store if empty
+*/
+tileLoadTask::tileLoadTask(tileLoader *_loader, const tileKey &_key, tileStore *_store, int _generation, const QByteArray &_data)
+{
+    loader = _loader;
+    key = _key;
+    store = _store;
+    generation = _generation;
+    data = _data;
+}
+
+/**
+* Reads and decodes the %tile, unless the request was cancelled while queued
+*/
+void tileLoadTask::run()
+{
+    QImage image;
+    bool unreadable = false;
+    if (generation == loader->generation.loadAcquire())
+    {
+        //missing, truncated or corrupt
+        unreadable = !image.loadFromData(data.isEmpty() ? store->read(key) : data);
+    }
+    QMetaObject::invokeMethod(loader, "slotTaskDone", Qt::QueuedConnection,
+                              Q_ARG(quint64, key.id),
+                              Q_ARG(QImage, image),
+                              Q_ARG(int, generation),
+                              Q_ARG(bool, unreadable));
+}
+
+/**
+* constructor
+* @param _loader loader the result is posted to
+* @param _key %tile to compose
+* @param _store where the children are read from
+* @param _generation current loader generation
+* @param _encode also encode the result as PNG
+*/
+tileComposeTask::tileComposeTask(tileLoader *_loader, const tileKey &_key, tileStore *_store, int _generation, bool _encode)
+{
+    loader = _loader;
+    key = _key;
+    store = _store;
+    generation = _generation;
+    encode = _encode;
+}
+
+/**
+* Reads and decodes the four children and scales them down into one %tile
+* The image is null if a child is missing or unreadable.
+*/
+void tileComposeTask::run()
+{
+    QImage image;
+    QByteArray data;
+    if (generation == loader->generation.loadAcquire())
+    {
+        QImage children[4];
+        bool complete = true;
+        for (int i=0; i<4 && complete; i++)
+        {
+            complete = children[i].loadFromData(store->read(key.child(i)));
+        }
+        if (complete)
+        {
+            image = QImage(children[0].size(), QImage::Format_ARGB32_Premultiplied);
+            image.fill(Qt::transparent);
+            int w = image.width()/2;
+            int h = image.height()/2;
+            QPainter p(&image);
+            p.setRenderHint(QPainter::SmoothPixmapTransform);
+            for (int i=0; i<4; i++)
+            {
+                p.drawImage(QRect((i & 1)*w, (i>>1)*h, w, h), children[i]);
+            }
+        }
+        if (encode && !image.isNull())
+        {
+            QBuffer buffer(&data);
+            buffer.open(QIODevice::WriteOnly);
+            image.save(&buffer, "PNG");
+        }
+    }
+    QMetaObject::invokeMethod(loader, "slotComposeDone", Qt::QueuedConnection,
+                              Q_ARG(quint64, key.id),
+                              Q_ARG(QImage, image),
+                              Q_ARG(QByteArray, data),
+                              Q_ARG(int, generation));
+}
+
+/**
+* constructor
+* @param _store where tiles are read from
+*/
+tileLoader::tileLoader(tileStore *_store, QObject *_parent):QObject(_parent)
+{
+    store = _store;
+    pool.setMaxThreadCount(QThread::idealThreadCount());
+    generation.storeRelease(0);
+}
+
+/**
+* destructor, waits for the running tasks so none of them posts to a dead object
+*/
+tileLoader::~tileLoader()
+{
+    cancelPending();
+    pool.waitForDone();
+}
+
+/**
+* Switches to another %tile store. Waits for the running tasks,
+* which still use the old one.
+*/
+void tileLoader::setStore(tileStore *_store)
+{
+    cancelPending();
+    pool.waitForDone();
+    pending.clear();
+    store = _store;
+}
+
+/**
+* Queues a %tile to be loaded. Requests for tiles already in flight are ignored,
+* unless their task was cancelled.
+* @param key %tile to load
+*/
+void tileLoader::request(const tileKey &key)
+{
+    int current = generation.loadAcquire();
+    QHash<tileKey,int>::const_iterator i = pending.constFind(key);
+    if (i != pending.constEnd() && i.value() == current)
+    {
+        return;
+    }
+    pending.insert(key, current);
+    pool.start(new tileLoadTask(this, key, store, current));
+}
+
+/**
+* Queues a %tile that's already in memory to be decoded, e.g. one that was
+* just downloaded. It replaces a load of the same %tile still in flight.
+* @param key %tile to decode
+* @param data encoded %tile
+*/
+void tileLoader::decode(const tileKey &key, const QByteArray &data)
+{
+    int current = generation.loadAcquire();
+    pending.insert(key, current);
+    pool.start(new tileLoadTask(this, key, store, current, data));
+}
+
+/**
+* Queues a %tile to be built out of its four children, which must all be in the store
+* The result is delivered through tileComposed(), with a null image if it failed.
+* @param key %tile to compose
+* @param encode also encode it as PNG so it can be written to the store
+*/
+void tileLoader::compose(const tileKey &key, bool encode)
+{
+    int current = generation.loadAcquire();
+    QHash<tileKey,int>::const_iterator i = pending.constFind(key);
+    if (i != pending.constEnd() && i.value() == current)
+    {
+        return;
+    }
+    pending.insert(key, current);
+    pool.start(new tileComposeTask(this, key, store, current, encode));
+}
+
+/**
+* @return true if the %tile is queued or being decoded
+*/
+bool tileLoader::isPending(const tileKey &key) const
+{
+    return pending.contains(key);
+}
+
+/**
+* Drops the tasks that haven't started yet, e.g. after a zoom change
+*/
+void tileLoader::cancelPending()
+{
+    generation.fetchAndAddOrdered(1);
+}
+
+void tileLoader::setMaxThreads(int threads)
+{
+    pool.setMaxThreadCount(threads);
+}
+
+int tileLoader::maxThreads() const
+{
+    return pool.maxThreadCount();
+}
+
+/**
+* Called in the loader's thread when a task finishes
+* Tiles that were read but couldn't be decoded are reported through tileUnreadable().
+*/
+void tileLoader::slotTaskDone(quint64 id, QImage image, int taskgeneration, bool unreadable)
+{
+    tileKey key;
+    key.id = id;
+    QHash<tileKey,int>::iterator i = pending.find(key);
+    if (i != pending.end() && i.value() == taskgeneration)
+    {
+        pending.erase(i);
+    }
+    if (!image.isNull())
+    {
+        emit tileLoaded(key, image);
+    }
+    else if (unreadable)
+    {
+        emit tileUnreadable(key);
+    }
+}
+
+/**
+* Called in the loader's thread when a compose task finishes
+* Cancelled tasks are dropped, they'll be queued again when needed.
+*/
+void tileLoader::slotComposeDone(quint64 id, QImage image, QByteArray data, int taskgeneration)
+{
+    tileKey key;
+    key.id = id;
+    QHash<tileKey,int>::iterator i = pending.find(key);
+    if (i != pending.end() && i.value() == taskgeneration)
+    {
+        pending.erase(i);
+    }
+    if (!image.isNull() || taskgeneration == generation.loadAcquire())
+    {
+        emit tileComposed(key, image, data);
+    }
+}
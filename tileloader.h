@@ -0,0 +1,99 @@
+#ifndef TILELOADER_H
+#define TILELOADER_H
+
+#include <QObject>
+#include <QRunnable>
+#include <QThreadPool>
+#include <QAtomicInt>
+#include <QImage>
+#include <QByteArray>
+#include <QHash>
+#include <QString>
+#include "tilekey.h"
+#include "tilestore.h"
+
+class tileLoader;
+
+/**
+* Reads and decodes one %tile on a worker thread
+* @see tileLoader
+*/
+class tileLoadTask : public QRunnable
+{
+public:
+    tileLoadTask(tileLoader *, const tileKey &, tileStore *, int, const QByteArray &data=QByteArray());
+    void run();
+
+private:
+    tileLoader *loader;/**< receives the decoded image. */
+    tileKey key;/**< %tile being loaded. */
+    tileStore *store;/**< where the %tile is read from. */
+    int generation;/**< loader generation the task was queued in. */
+    QByteArray data;/**< encoded %tile if it's already in memory, e.g. just downloaded. */
+};
+
+/**
+* Builds one %tile out of its four cached children on a worker thread
+* @see tileLoader::compose()
+*/
+class tileComposeTask : public QRunnable
+{
+public:
+    tileComposeTask(tileLoader *, const tileKey &, tileStore *, int, bool);
+    void run();
+
+private:
+    tileLoader *loader;/**< receives the composed image. */
+    tileKey key;/**< %tile being composed. */
+    tileStore *store;/**< where the children are read from. */
+    int generation;/**< loader generation the task was queued in. */
+    bool encode;/**< also encode the result so it can be written to the store. */
+};
+
+/**
+* Loads cached tiles from the %tile store on a thread pool
+* Tiles are read and decoded to QImage off the GUI thread, as well as
+* freshly downloaded ones handed over with decode(),
+* results are delivered through tileLoaded() in the loader's thread.
+*/
+class tileLoader : public QObject
+{
+    Q_OBJECT
+
+    friend class tileLoadTask;
+    friend class tileComposeTask;
+
+public:
+    tileLoader(tileStore *, QObject *_parent=0);
+    ~tileLoader();
+
+    void setStore(tileStore *);
+    void request(const tileKey &);
+    void decode(const tileKey &, const QByteArray &);
+    void compose(const tileKey &, bool encode=false);
+    bool isPending(const tileKey &) const;
+    void cancelPending();
+
+    void setMaxThreads(int);
+    int maxThreads() const;
+
+signals:
+    void tileLoaded(tileKey, QImage);
+    /**
+    * Emitted when a %tile in the store is missing or can't be decoded
+    */
+    void tileUnreadable(tileKey);
+    void tileComposed(tileKey, QImage, QByteArray);
+
+private:
+    QThreadPool pool;/**< worker threads doing the reads and decodes. */
+    tileStore *store;/**< where tiles are read from. */
+    QHash<tileKey,int> pending;/**< tiles queued or being decoded, with the generation of their task. */
+    QAtomicInt generation;/**< bumped to drop queued tasks that are no longer needed. */
+
+private slots:
+    void slotTaskDone(quint64, QImage, int, bool);
+    void slotComposeDone(quint64, QImage, QByteArray, int);
+};
+
+#endif
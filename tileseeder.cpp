@@ -0,0 +1,759 @@
+#include "tileseeder.h"
+#include <QSettings>
+#include <QStringList>
+#include <QDateTime>
+#include <QRectF>
+#include <QVector>
+#include <QtMath>
+#include <QDebug>
+#include <algorithm>
+
+/**
+* the mercator projection doesn't reach the poles
+*/
+#define SEED_MAX_LATITUDE 85.0511
+
+/**
+* size of the tiles in px, only used to project the area
+*/
+#define SEED_TILESIZE 256
+
+/**
+* constructor, an empty job
+*/
+seedJob::seedJob()
+{
+    minZoom = 0;
+    maxZoom = 0;
+    downloaded = 0;
+    skipped = 0;
+    failed = 0;
+}
+
+/**
+* @return a job for a bounding box
+* @param corner1 longitude and latitude of a corner in degrees
+* @param corner2 longitude and latitude of the opposite corner
+* @param minzoom first zoom level
+* @param maxzoom last zoom level
+*/
+seedJob seedJob::boundingBox(QPointF corner1, QPointF corner2, int minzoom, int maxzoom)
+{
+    return polygon(QPolygonF(QRectF(corner1, corner2).normalized()), minzoom, maxzoom);
+}
+
+/**
+* @return a job for a polygon
+* @param area longitude and latitude of the vertices in degrees
+* @param minzoom first zoom level
+* @param maxzoom last zoom level
+*/
+seedJob seedJob::polygon(const QPolygonF &area, int minzoom, int maxzoom)
+{
+    seedJob job;
+    for (int k=0; k<area.size(); k++)
+    {
+        job.area << QPointF(qBound(-180.0, area.at(k).x(), 180.0),
+                            qBound(-SEED_MAX_LATITUDE, area.at(k).y(), SEED_MAX_LATITUDE));
+    }
+    job.minZoom = qBound(0, qMin(minzoom, maxzoom), 30);
+    job.maxZoom = qBound(0, qMax(minzoom, maxzoom), 30);
+    return job;
+}
+
+/**
+* @return true if the area is a bounding box
+*/
+bool seedJob::isBox() const
+{
+    return area == QPolygonF(area.boundingRect());
+}
+
+/**
+* @return number of tiles downloaded, skipped or failed
+*/
+quint64 seedJob::processed() const
+{
+    return downloaded + skipped + failed;
+}
+
+/**
+* Saves the job to an ini file
+* @return false if it couldn't be written
+*/
+bool seedJob::save(const QString &file) const
+{
+    QSettings s(file, QSettings::IniFormat);
+    s.clear();
+    QStringList points;
+    for (int k=0; k<area.size(); k++)
+    {
+        points << QString("%1 %2").arg(area.at(k).x(), 0, 'f', 7).arg(area.at(k).y(), 0, 'f', 7);
+    }
+    s.setValue("area", points);
+    s.setValue("minzoom", minZoom);
+    s.setValue("maxzoom", maxZoom);
+    s.setValue("cursor", QString::number(cursor.id));
+    s.setValue("pending", keyList(pending));
+    s.setValue("failedtiles", keyList(failedTiles));
+    s.setValue("downloaded", QString::number(downloaded));
+    s.setValue("skipped", QString::number(skipped));
+    s.setValue("failed", QString::number(failed));
+    s.sync();
+    return s.status() == QSettings::NoError;
+}
+
+/**
+* Loads a job saved with save()
+* @return false if the file couldn't be read or has no area
+*/
+bool seedJob::load(const QString &file)
+{
+    QSettings s(file, QSettings::IniFormat);
+    if (s.status() != QSettings::NoError)
+    {
+        return false;
+    }
+    QStringList points = s.value("area").toStringList();
+    area.clear();
+    for (int k=0; k<points.size(); k++)
+    {
+        QStringList lonlat = points.at(k).split(' ');
+        if (lonlat.size() == 2)
+        {
+            area << QPointF(lonlat.at(0).toDouble(), lonlat.at(1).toDouble());
+        }
+    }
+    minZoom = s.value("minzoom").toInt();
+    maxZoom = s.value("maxzoom").toInt();
+    cursor.id = s.value("cursor").toString().toULongLong();
+    pending = parseKeyList(s.value("pending").toString());
+    failedTiles = parseKeyList(s.value("failedtiles").toString());
+    downloaded = s.value("downloaded").toString().toULongLong();
+    skipped = s.value("skipped").toString().toULongLong();
+    failed = s.value("failed").toString().toULongLong();
+    return area.size() >= 3;
+}
+
+/**
+* @return the ids of some tiles separated by spaces
+*/
+QString seedJob::keyList(const QList<tileKey> &keys)
+{
+    QStringList ids;
+    for (int k=0; k<keys.size(); k++)
+    {
+        ids << QString::number(keys.at(k).id);
+    }
+    return ids.join(' ');
+}
+
+/**
+* @return the tiles of a list written by keyList(), invalid ids are dropped
+*/
+QList<tileKey> seedJob::parseKeyList(const QString &text)
+{
+    QList<tileKey> keys;
+    QStringList ids = text.split(' ', Qt::SkipEmptyParts);
+    for (int k=0; k<ids.size(); k++)
+    {
+        tileKey key;
+        key.id = ids.at(k).toULongLong();
+        if (key.isValid())
+        {
+            keys.append(key);
+        }
+    }
+    return keys;
+}
+
+/**
+* constructor, starts at the cursor of the job
+*/
+seedIterator::seedIterator(const seedJob &_job)
+{
+    job = _job;
+    box = job.isBox();
+    if (job.cursor.isValid() && job.cursor.zoom() >= job.minZoom)
+    {
+        beginZoom(job.cursor.zoom());
+        x = job.cursor.x();
+        y = job.cursor.y();
+    }
+    else
+    {
+        beginZoom(job.minZoom);
+    }
+}
+
+/**
+* Projects the area to a zoom level and starts at its top left %tile
+*/
+void seedIterator::beginZoom(int z)
+{
+    zoom = z;
+    spansColumn = -1;
+    if (zoom > job.maxZoom)
+    {
+        return;
+    }
+    pixelArea.clear();
+    for (int k=0; k<job.area.size(); k++)
+    {
+        pixelArea << myMercator::geoCoordToPixelF(job.area.at(k), zoom, SEED_TILESIZE);
+    }
+    QRectF r = pixelArea.boundingRect();
+    qint64 last = ((qint64)1<<zoom) - 1;
+    left = qBound((qint64)0, (qint64)qFloor(r.left()/SEED_TILESIZE), last);
+    right = qBound((qint64)0, (qint64)qFloor(r.right()/SEED_TILESIZE), last);
+    top = qBound((qint64)0, (qint64)qFloor(r.top()/SEED_TILESIZE), last);
+    bottom = qBound((qint64)0, (qint64)qFloor(r.bottom()/SEED_TILESIZE), last);
+    x = left;
+    y = top;
+}
+
+/**
+* Works out which rows of a column a polygon covers
+* A %tile is covered if the polygon reaches into it. The rows are those of
+* the pieces of the edges inside the column, plus the inside of the polygon
+* along the column's left and right sides.
+* @param area polygon in map px
+* @param column column of tiles
+* @param top first row to report
+* @param bottom last row to report
+* @return first and last row of each run of covered rows, in order
+*/
+QList<QPair<qint64,qint64> > seedIterator::columnSpans(const QPolygonF &area, qint64 column, qint64 top, qint64 bottom)
+{
+    const qreal x0 = column*SEED_TILESIZE;
+    const qreal x1 = x0 + SEED_TILESIZE;
+    const int n = area.size();
+    QList<QPair<qreal,qreal> > ranges;
+    for (int k=0; k<n; k++)
+    {
+        QPointF a = area.at(k);
+        QPointF b = area.at((k+1) % n);
+        if (qMax(a.x(), b.x()) < x0 || qMin(a.x(), b.x()) > x1)
+        {
+            continue;
+        }
+        qreal ya = a.y();
+        qreal yb = b.y();
+        if (a.x() != b.x())
+        {
+            qreal t0 = (x0 - a.x())/(b.x() - a.x());
+            qreal t1 = (x1 - a.x())/(b.x() - a.x());
+            if (t0 > t1)
+            {
+                qSwap(t0, t1);
+            }
+            ya = a.y() + qMax((qreal)0, t0)*(b.y() - a.y());
+            yb = a.y() + qMin((qreal)1, t1)*(b.y() - a.y());
+        }
+        ranges.append(qMakePair(qMin(ya, yb), qMax(ya, yb)));
+    }
+    const qreal sides[2] = {x0, x1};
+    for (int s=0; s<2; s++)
+    {
+        QVector<qreal> crossings;
+        for (int k=0; k<n; k++)
+        {
+            QPointF a = area.at(k);
+            QPointF b = area.at((k+1) % n);
+            if ((a.x() <= sides[s]) != (b.x() <= sides[s]))
+            {
+                crossings.append(a.y() + (sides[s] - a.x())*(b.y() - a.y())/(b.x() - a.x()));
+            }
+        }
+        std::sort(crossings.begin(), crossings.end());
+        for (int k=0; k+1<crossings.size(); k+=2)
+        {
+            ranges.append(qMakePair(crossings.at(k), crossings.at(k+1)));
+        }
+    }
+
+    QList<QPair<qint64,qint64> > rows;
+    for (int k=0; k<ranges.size(); k++)
+    {
+        qint64 first = qFloor(ranges.at(k).first/SEED_TILESIZE);
+        qint64 last = qMax(first, (qint64)qCeil(ranges.at(k).second/SEED_TILESIZE) - 1);
+        if (last >= top && first <= bottom)
+        {
+            rows.append(qMakePair(qMax(first, top), qMin(last, bottom)));
+        }
+    }
+    std::sort(rows.begin(), rows.end());
+    QList<QPair<qint64,qint64> > spans;
+    for (int k=0; k<rows.size(); k++)
+    {
+        if (!spans.isEmpty() && rows.at(k).first <= spans.last().second + 1)
+        {
+            spans.last().second = qMax(spans.last().second, rows.at(k).second);
+        }
+        else
+        {
+            spans.append(rows.at(k));
+        }
+    }
+    return spans;
+}
+
+/**
+* @param key receives the next %tile of the job
+* @return false when all the tiles have been walked
+*/
+bool seedIterator::next(tileKey &key)
+{
+    while (zoom <= job.maxZoom)
+    {
+        if (x > right)
+        {
+            beginZoom(zoom+1);
+            continue;
+        }
+        if (!box)
+        {
+            if (spansColumn != x)
+            {
+                spans = columnSpans(pixelArea, x, top, bottom);
+                spansColumn = x;
+            }
+            int s = 0;
+            while (s < spans.size() && spans.at(s).second < y)
+            {
+                s++;
+            }
+            if (s == spans.size())
+            {
+                y = top;
+                x++;
+                continue;
+            }
+            y = qMax(y, spans.at(s).first);
+        }
+        qint64 cx = x;
+        qint64 cy = y;
+        if (++y > bottom)
+        {
+            y = top;
+            x++;
+        }
+        key = tileKey(zoom, (quint32)cx, (quint32)cy);
+        return true;
+    }
+    return false;
+}
+
+/**
+* @return number of tiles left, without moving the iterator
+* It's immediate for a bounding box, a polygon has its rows counted column by column.
+*/
+quint64 seedIterator::count() const
+{
+    seedIterator i = *this;
+    quint64 n = 0;
+    while (i.zoom <= i.job.maxZoom)
+    {
+        if (box)
+        {
+            //what's left of the current column, then the columns after it
+            if (i.x <= i.right)
+            {
+                n += (i.bottom - i.y + 1) + (i.right - i.x)*(i.bottom - i.top + 1);
+            }
+        }
+        else
+        {
+            for (qint64 c=i.x; c<=i.right; c++)
+            {
+                QList<QPair<qint64,qint64> > rows = columnSpans(i.pixelArea, c, i.top, i.bottom);
+                for (int k=0; k<rows.size(); k++)
+                {
+                    qint64 first = c == i.x ? qMax(i.y, rows.at(k).first) : rows.at(k).first;
+                    if (rows.at(k).second >= first)
+                    {
+                        n += rows.at(k).second - first + 1;
+                    }
+                }
+            }
+        }
+        i.beginZoom(i.zoom+1);
+    }
+    return n;
+}
+
+/**
+* @return the %tile next() would start from, past the last zoom level when done
+*/
+tileKey seedIterator::position() const
+{
+    if (zoom > job.maxZoom || x > right)
+    {
+        return tileKey(qMin(zoom+1, job.maxZoom+1), 0, 0);
+    }
+    return tileKey(zoom, (quint32)x, (quint32)y);
+}
+
+/**
+* constructor
+* @param _store where the tiles are written
+* @param _layout tile server the tiles are downloaded from
+*/
+tileSeeder::tileSeeder(tileStore *_store, const servermanager &_layout, QObject *_parent):QObject(_parent)
+{
+    store = _store;
+    layout = _layout;
+    diskCache = 0;
+    iterator = 0;
+    totalTiles = 0;
+    running = false;
+    exhausted = false;
+    rate = 0;
+    tokens = 0;
+    lastFeed = 0;
+    sinceSave = 0;
+    downloader = new tileDownloader(this);
+    downloader->setMaxConcurrent(4);
+    //failures are retried by the seeder, under the rate limit
+    downloader->setMaxRetries(0);
+    connect(downloader, SIGNAL(tileReady(tileKey,QByteArray,tileFreshness)),this, SLOT(slotTileReady(tileKey,QByteArray,tileFreshness)));
+    connect(downloader, SIGNAL(tileFailed(tileKey,QNetworkReply::NetworkError)),this, SLOT(slotTileFailed(tileKey,QNetworkReply::NetworkError)));
+    connect(&feedTimer, SIGNAL(timeout()),this, SLOT(slotFeed()));
+}
+
+/**
+* destructor, a running job is stopped and saved
+*/
+tileSeeder::~tileSeeder()
+{
+    stop();
+    delete iterator;
+}
+
+/**
+* Uses the index of the store to skip cached tiles, and adds the new ones to it
+*/
+void tileSeeder::setDiskCache(tileDiskCache *cache)
+{
+    diskCache = cache;
+}
+
+/**
+* Sets the file the job state is saved to, so it can be resumed
+* @see seedJob::load()
+*/
+void tileSeeder::setJobFile(const QString &file)
+{
+    jobFile = file;
+}
+
+/**
+* Caps the requests sent to the tile server
+* @param requests maximum requests per second, 0 for no limit
+*/
+void tileSeeder::setRateLimit(qreal requests)
+{
+    rate = qMax((qreal)0, requests);
+    if (running)
+    {
+        feedTimer.start(rate > 0 ? qMax(10, (int)(1000/rate)) : 100);
+    }
+}
+
+qreal tileSeeder::rateLimit() const
+{
+    return rate;
+}
+
+/**
+* Sets the maximum number of requests in flight
+*/
+void tileSeeder::setMaxConcurrent(int downloads)
+{
+    downloader->setMaxConcurrent(downloads);
+    downloader->setMaxPerHost(downloads);
+}
+
+int tileSeeder::maxConcurrent() const
+{
+    return downloader->maxConcurrent();
+}
+
+/**
+* Starts or resumes a job, from its cursor
+* The tiles it left pending and those that failed are requested first.
+* @return false if a job is already running
+*/
+bool tileSeeder::start(const seedJob &job)
+{
+    if (running)
+    {
+        return false;
+    }
+    current = job;
+    totalTiles = countTiles(job);
+    delete iterator;
+    iterator = new seedIterator(job);
+    outstanding.clear();
+    retries.clear();
+    attempts.clear();
+    failedTiles.clear();
+    QList<tileKey> again = job.pending + job.failedTiles;
+    for (int k=0; k<again.size(); k++)
+    {
+        seedRetry r;
+        r.key = again.at(k);
+        r.due = 0;
+        retries.append(r);
+    }
+    //they are counted again when they're done
+    current.failed -= qMin(current.failed, (quint64)job.failedTiles.size());
+    current.pending.clear();
+    current.failedTiles.clear();
+    exhausted = false;
+    sinceSave = 0;
+    tokens = rate > 0 ? 1 : 0;
+    lastFeed = QDateTime::currentMSecsSinceEpoch();
+    running = true;
+    feedTimer.start(rate > 0 ? qMax(10, (int)(1000/rate)) : 100);
+    slotFeed();
+    return true;
+}
+
+/**
+* Stops the job and saves its state. Requests in flight are ignored.
+*/
+void tileSeeder::stop()
+{
+    if (!running)
+    {
+        return;
+    }
+    running = false;
+    feedTimer.stop();
+    downloader->clearQueue();
+    saveJob();
+    outstanding.clear();
+    retries.clear();
+    emit finished(false);
+}
+
+/**
+* @return true while a job is running
+*/
+bool tileSeeder::isRunning() const
+{
+    return running;
+}
+
+/**
+* @return the job being run with its counters, as last saved
+*/
+seedJob tileSeeder::job() const
+{
+    return current;
+}
+
+/**
+* @return number of tiles in the job being run
+*/
+quint64 tileSeeder::total() const
+{
+    return totalTiles;
+}
+
+/**
+* @return number of tiles in a job, from the beginning
+*/
+quint64 tileSeeder::countTiles(const seedJob &job)
+{
+    seedJob all = job;
+    all.cursor = tileKey();
+    return seedIterator(all).count();
+}
+
+/**
+* Hands out tiles to the downloader while there's room and the rate allows it
+* Tiles due for a retry go first. Cached tiles are counted as skipped without a request.
+*/
+void tileSeeder::slotFeed()
+{
+    if (!running)
+    {
+        return;
+    }
+    qint64 now = QDateTime::currentMSecsSinceEpoch();
+    if (rate > 0)
+    {
+        //short bursts up to a second worth of requests
+        tokens = qMin(qMax(rate, (qreal)1), tokens + (now - lastFeed)*rate/1000.0);
+    }
+    lastFeed = now;
+
+    int checks = 0;
+    tileKey key;
+    while (outstanding.size() < 2*downloader->maxConcurrent()
+           && (rate <= 0 || tokens >= 1) && checks < SEED_CHECKS_PER_FEED)
+    {
+        int due = 0;
+        while (due < retries.size() && retries.at(due).due > now)
+        {
+            due++;
+        }
+        if (due < retries.size())
+        {
+            key = retries.takeAt(due).key;
+        }
+        else if (exhausted)
+        {
+            break;
+        }
+        else if (!iterator->next(key))
+        {
+            exhausted = true;
+            break;
+        }
+        checks++;
+        bool cached = diskCache ? diskCache->contains(key) : store->contains(key);
+        if (cached)
+        {
+            current.skipped++;
+            continue;
+        }
+        downloader->enqueue(key, layout.getTileUrl(key));
+        outstanding.insert(key);
+        if (rate > 0)
+        {
+            tokens -= 1;
+        }
+    }
+    downloader->startDownloads();
+    emit progress(current.processed(), totalTiles);
+
+    if (exhausted && outstanding.isEmpty() && retries.isEmpty())
+    {
+        finish();
+    }
+    else if (checks >= SEED_CHECKS_PER_FEED)
+    {
+        //a long run of cached tiles, carry on without blocking the event loop
+        QTimer::singleShot(0, this, SLOT(slotFeed()));
+    }
+}
+
+/**
+* Slot that gets called when a %tile of the job is downloaded
+*/
+void tileSeeder::slotTileReady(tileKey key, QByteArray data, tileFreshness fresh)
+{
+    if (!outstanding.remove(key))
+    {
+        return;
+    }
+    attempts.remove(key);
+    if (store->write(key, data))
+    {
+        current.downloaded++;
+        if (diskCache)
+        {
+            diskCache->insert(key, data.size(), fresh);
+        }
+    }
+    else
+    {
+        current.failed++;
+        failedTiles.insert(key);
+    }
+    tileDone();
+}
+
+/**
+* Slot that gets called when a request for a %tile of the job failed
+* It's requested again later, through the rate limit, until it runs out of
+* attempts or the server says it doesn't have it.
+*/
+void tileSeeder::slotTileFailed(tileKey key, QNetworkReply::NetworkError error)
+{
+    if (!outstanding.remove(key))
+    {
+        return;
+    }
+    int attempt = ++attempts[key];
+    if (attempt < SEED_MAX_ATTEMPTS && !isPermanent(error))
+    {
+        seedRetry r;
+        r.key = key;
+        r.due = QDateTime::currentMSecsSinceEpoch() + ((qint64)SEED_RETRY_DELAY<<(attempt-1));
+        retries.append(r);
+        slotFeed();
+        return;
+    }
+    attempts.remove(key);
+    current.failed++;
+    failedTiles.insert(key);
+    tileDone();
+}
+
+/**
+* @return true if asking again won't help, e.g. the server doesn't have the %tile
+*/
+bool tileSeeder::isPermanent(QNetworkReply::NetworkError error)
+{
+    switch (error)
+    {
+    case QNetworkReply::ContentNotFoundError:
+    case QNetworkReply::ContentGoneError:
+    case QNetworkReply::ContentAccessDenied:
+    case QNetworkReply::ContentOperationNotPermittedError:
+    case QNetworkReply::AuthenticationRequiredError:
+    case QNetworkReply::ProtocolInvalidOperationError:
+        return true;
+    default:
+        return false;
+    }
+}
+
+/**
+* Saves the job every now and then and hands out more tiles
+*/
+void tileSeeder::tileDone()
+{
+    if (++sinceSave >= SEED_SAVE_EVERY)
+    {
+        saveJob();
+    }
+    slotFeed();
+}
+
+/**
+* Saves the job with the tiles handed out but not done yet
+* The counters only count finished tiles, so a resumed job counts each
+* %tile once. The store is flushed first so the job never gets ahead of the disk.
+*/
+void tileSeeder::saveJob()
+{
+    store->flush();
+    current.cursor = iterator->position();
+    current.pending = outstanding.values();
+    for (int k=0; k<retries.size(); k++)
+    {
+        current.pending.append(retries.at(k).key);
+    }
+    current.failedTiles = failedTiles.values();
+    sinceSave = 0;
+    if (!jobFile.isEmpty() && !current.save(jobFile))
+    {
+        qDebug() <<"error writing to file "<<jobFile;
+    }
+}
+
+/**
+* The last %tile of the job is done
+*/
+void tileSeeder::finish()
+{
+    running = false;
+    feedTimer.stop();
+    saveJob();
+    emit finished(true);
+}
@@ -0,0 +1,182 @@
+#ifndef TILESEEDER_H
+#define TILESEEDER_H
+
+#include <QObject>
+#include <QPointF>
+#include <QPolygonF>
+#include <QSet>
+#include <QHash>
+#include <QList>
+#include <QPair>
+#include <QString>
+#include <QTimer>
+#include "tilekey.h"
+#include "tilefreshness.h"
+#include "mercator.h"
+#include "servermanager.h"
+#include "tilestore.h"
+#include "tilediskcache.h"
+#include "tiledownloader.h"
+
+/**
+* tiles checked against the cache per pass before yielding to the event loop
+*/
+#define SEED_CHECKS_PER_FEED 1000
+/**
+* the job state is saved every this many finished downloads
+*/
+#define SEED_SAVE_EVERY 100
+/**
+* times a %tile is requested before it's counted as failed
+*/
+#define SEED_MAX_ATTEMPTS 4
+/**
+* wait before requesting a failed %tile again in ms, doubled with each attempt
+*/
+#define SEED_RETRY_DELAY 2000
+
+/**
+* What to download for offline use and how far it got
+* Tiles are processed zoom level by zoom level, by column and then by row,
+* which is also the order of their tileKey ids. Every %tile before the cursor
+* has been handed out, those not done yet are kept in pending and the ones
+* that failed in failedTiles, both are requested again on resume.
+* The job is saved as an ini file.
+* @see tileSeeder
+*/
+struct seedJob
+{
+    QPolygonF area;/**< area to download, longitude and latitude in degrees. */
+    int minZoom;/**< first zoom level. */
+    int maxZoom;/**< last zoom level. */
+    tileKey cursor;/**< every %tile before this one was handed out, invalid if none was. */
+    QList<tileKey> pending;/**< tiles before the cursor that aren't done yet. */
+    QList<tileKey> failedTiles;/**< tiles before the cursor that couldn't be downloaded. */
+    quint64 downloaded;/**< tiles downloaded so far. */
+    quint64 skipped;/**< tiles that were already cached. */
+    quint64 failed;/**< tiles that couldn't be downloaded, the size of failedTiles. */
+
+    seedJob();
+    static seedJob boundingBox(QPointF, QPointF, int, int);
+    static seedJob polygon(const QPolygonF &, int, int);
+    bool isBox() const;
+    quint64 processed() const;
+    bool save(const QString &) const;
+    bool load(const QString &);
+
+private:
+    static QString keyList(const QList<tileKey> &);
+    static QList<tileKey> parseKeyList(const QString &);
+};
+
+/**
+* Walks the tiles of a seedJob in order, starting at its cursor
+* For a polygon, the rows it covers are worked out a column at a time.
+*/
+class seedIterator
+{
+public:
+    seedIterator(const seedJob &);
+
+    bool next(tileKey &);
+    quint64 count() const;
+    tileKey position() const;
+
+private:
+    seedJob job;/**< job being walked. */
+    bool box;/**< the area is a bounding box, no need to test each %tile. */
+    int zoom;/**< current zoom level. */
+    qint64 left;/**< leftmost column of the area at the current zoom level. */
+    qint64 right;/**< rightmost column. */
+    qint64 top;/**< topmost row. */
+    qint64 bottom;/**< bottommost row. */
+    qint64 x;/**< column of the next %tile. */
+    qint64 y;/**< row of the next %tile. */
+    QPolygonF pixelArea;/**< the area in map px at the current zoom level. */
+    qint64 spansColumn;/**< column the spans belong to, -1 if none. */
+    QList<QPair<qint64,qint64> > spans;/**< first and last row of each run of rows the area covers in that column. */
+
+    void beginZoom(int);
+    static QList<QPair<qint64,qint64> > columnSpans(const QPolygonF &, qint64, qint64, qint64);
+};
+
+/**
+* A %tile of a seed job waiting to be requested again
+*/
+struct seedRetry
+{
+    tileKey key;/**< %tile to request. */
+    qint64 due;/**< not before this time, in ms since epoch. */
+};
+
+/**
+* Downloads all the tiles of an area and a zoom range for offline use
+* Cached tiles are skipped, the rest go through a tileDownloader of its own
+* so they get the same concurrency and server circuit breaker as the map.
+* Failed tiles are retried by the seeder with a growing delay, so retries
+* also go through the rate limit.
+* Requests can be capped to a rate, progress is reported as tiles are
+* processed and the job state is saved regularly so an interrupted job
+* resumes where it stopped.
+* @see seedJob
+*/
+class tileSeeder : public QObject
+{
+    Q_OBJECT
+
+public:
+    tileSeeder(tileStore *, const servermanager &, QObject *_parent=0);
+    ~tileSeeder();
+
+    void setDiskCache(tileDiskCache *);
+    void setJobFile(const QString &);
+    void setRateLimit(qreal);
+    qreal rateLimit() const;
+    void setMaxConcurrent(int);
+    int maxConcurrent() const;
+
+    bool start(const seedJob &);
+    void stop();
+    bool isRunning() const;
+    seedJob job() const;
+    quint64 total() const;
+
+    static quint64 countTiles(const seedJob &);
+
+signals:
+    void progress(quint64, quint64);
+    void finished(bool);
+
+private:
+    tileStore *store;/**< where the tiles are written. */
+    tileDiskCache *diskCache;/**< index of the store, optional. */
+    servermanager layout;/**< gives the url of each %tile. */
+    tileDownloader *downloader;/**< downloads the tiles. */
+    seedIterator *iterator;/**< next tiles of the job. */
+    QTimer feedTimer;/**< keeps feeding the downloader when rate limited. */
+    QString jobFile;/**< where the job state is saved, empty to not save it. */
+    seedJob current;/**< job being run, with its counters. */
+    quint64 totalTiles;/**< number of tiles in the job. */
+    bool running;/**< a job is being run. */
+    bool exhausted;/**< every %tile of the job has been handed out. */
+    qreal rate;/**< maximum requests per second, 0 for no limit. */
+    qreal tokens;/**< requests that can be sent right now under the rate limit. */
+    qint64 lastFeed;/**< time of the last feed, in ms since epoch. */
+    QSet<tileKey> outstanding;/**< tiles queued or in flight. */
+    QList<seedRetry> retries;/**< tiles waiting to be requested again. */
+    QHash<tileKey,int> attempts;/**< failed requests so far of the tiles being retried. */
+    QSet<tileKey> failedTiles;/**< tiles that gave up, requested again on resume. */
+    int sinceSave;/**< downloads finished since the job was last saved. */
+
+    void saveJob();
+    void finish();
+    void tileDone();
+    static bool isPermanent(QNetworkReply::NetworkError);
+
+private slots:
+    void slotFeed();
+    void slotTileReady(tileKey, QByteArray, tileFreshness);
+    void slotTileFailed(tileKey, QNetworkReply::NetworkError);
+};
+
+#endif
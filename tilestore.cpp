@@ -0,0 +1,450 @@
+#include "tilestore.h"
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QDirIterator>
+#include <QDateTime>
+#include <QThread>
+#include <QMutexLocker>
+#include <QSqlQuery>
+#include <QSqlError>
+#include <QVariant>
+#include <QDebug>
+#include <QAtomicInt>
+#include <QThreadStorage>
+
+/**
+* how long the owner's connection waits for a worker holding the file, in ms.
+* It's the GUI thread's, a batch that can't be committed in time stays pending.
+*/
+#define MBTILES_OWNER_BUSY_TIMEOUT 100
+/**
+* how long worker connections wait for the file, in ms
+*/
+#define MBTILES_WORKER_BUSY_TIMEOUT 5000
+
+/**
+* numbers the mbtilesTileStore objects, so no two connections get the same name
+*/
+static QAtomicInt mbtilesConnections;
+
+/**
+* Connections a worker thread opened to MBTiles files, closed when the thread finishes
+*/
+struct mbtilesThreadConnections
+{
+    QStringList names;/**< connections opened by the thread. */
+
+    ~mbtilesThreadConnections()
+    {
+        for (int i=0; i<names.size(); i++)
+        {
+            QSqlDatabase::database(names.at(i), false).close();
+            QSqlDatabase::removeDatabase(names.at(i));
+        }
+    }
+};
+
+static QThreadStorage<mbtilesThreadConnections *> mbtilesThreads;
+
+tileStore::~tileStore()
+{
+}
+
+/**
+* @return true if the %tile is in the store. Stores should override it
+* with something cheaper than reading the %tile.
+*/
+bool tileStore::contains(const tileKey &key)
+{
+    return !read(key).isEmpty();
+}
+
+/**
+* Commits buffered writes. Stores that write straight away don't need it.
+*/
+void tileStore::flush()
+{
+}
+
+/**
+* Copies every %tile from one store to another, e.g. to import a folder
+* cache into an .mbtiles file or to export it back
+* @param from source store
+* @param to destination store
+* @return number of tiles copied
+*/
+int tileStore::copyTiles(tileStore *from, tileStore *to)
+{
+    int copied = 0;
+    from->flush();
+    QHash<tileKey,diskTile> tiles = from->scan();
+    QHash<tileKey,diskTile>::const_iterator i = tiles.constBegin();
+    for (; i!=tiles.constEnd(); ++i)
+    {
+        QByteArray data = from->read(i.key());
+        if (data.size() && to->write(i.key(), data))
+        {
+            copied++;
+        }
+    }
+    to->flush();
+    return copied;
+}
+
+/**
+* constructor
+* @param _folder root application folder
+* @param _layout tile server that gives the cache folder and file templates
+*/
+dirTileStore::dirTileStore(const QString &_folder, const servermanager &_layout)
+{
+    folder = _folder;
+    root = folder+"/";
+    layout = _layout;
+}
+
+/**
+* @return absolute path of the %tile file
+*/
+QString dirTileStore::tileFile(const tileKey &key) const
+{
+    QString file = root;
+    layout.tileFile(key,file);
+    return file;
+}
+
+/**
+* @return the cache folder of the tile server
+*/
+QString dirTileStore::location() const
+{
+    return folder+"/"+layout.tileCacheFolder();
+}
+
+QByteArray dirTileStore::read(const tileKey &key)
+{
+    QFile f(tileFile(key));
+    if (f.open(QIODevice::ReadOnly))
+    {
+        return f.readAll();
+    }
+    return QByteArray();
+}
+
+/**
+* Writes the %tile file, creating its folder the first time it's needed
+*/
+bool dirTileStore::write(const tileKey &key, const QByteArray &data)
+{
+    QString path = root;
+    layout.tileDir(key,path);
+    if (!knownDirs.contains(path))
+    {
+        QDir().mkpath(path);
+        knownDirs.insert(path);
+    }
+    QFile f(tileFile(key));
+    if (!f.open(QIODevice::WriteOnly) || f.write(data) <= 0)
+    {
+        qDebug() <<"error writing to file "<<f.fileName();
+        return false;
+    }
+    return true;
+}
+
+bool dirTileStore::remove(const tileKey &key)
+{
+    return QFile::remove(tileFile(key));
+}
+
+bool dirTileStore::contains(const tileKey &key)
+{
+    return QFile::exists(tileFile(key));
+}
+
+/**
+* Walks the cache folder
+* Files are mapped back to tiles with the server's path and tile templates,
+* those that don't follow them are skipped.
+* @return every %tile found, with its size and last write time
+*/
+QHash<tileKey,diskTile> dirTileStore::scan()
+{
+    QHash<tileKey,diskTile> tiles;
+    QDirIterator it(root + layout.tileCacheFolder(), QDir::Files, QDirIterator::Subdirectories);
+    while (it.hasNext())
+    {
+        QString path = it.next();
+        tileKey key;
+        if (!path.startsWith(root) || !layout.tileOf(path.mid(root.size()), key))
+        {
+            continue;
+        }
+        QFileInfo info = it.fileInfo();
+        diskTile t;
+        t.size = info.size();
+        //last access isn't reliable on all filesystems, use the write time
+        t.lastAccess = info.lastModified().toMSecsSinceEpoch()/1000;
+        t.fresh.fetched = t.lastAccess;
+        tiles.insert(key,t);
+    }
+    return tiles;
+}
+
+/**
+* constructor, creates the MBTiles tables if the file is new
+* @param _fileName path of the .mbtiles file
+* @param batchsize number of tiles written per transaction
+*/
+mbtilesTileStore::mbtilesTileStore(const QString &_fileName, int batchsize)
+{
+    fileName = _fileName;
+    batchSize = qMax(1, batchsize);
+    connectionPrefix = QString("cacamap_mbtiles_%1_").arg(mbtilesConnections.fetchAndAddOrdered(1));
+    owner = QThread::currentThread();
+    ownerConnection = connectionPrefix + "owner";
+    open(ownerConnection, MBTILES_OWNER_BUSY_TIMEOUT);
+
+    QSqlQuery q(QSqlDatabase::database(ownerConnection, false));
+    //readers don't block the writer, nor the other way around
+    q.exec("PRAGMA journal_mode=WAL");
+    q.exec("CREATE TABLE IF NOT EXISTS metadata (name text, value text)");
+    q.exec("CREATE TABLE IF NOT EXISTS tiles (zoom_level integer, tile_column integer, tile_row integer, tile_data blob)");
+    q.exec("CREATE UNIQUE INDEX IF NOT EXISTS tile_index ON tiles (zoom_level, tile_column, tile_row)");
+    q.exec("INSERT INTO metadata SELECT 'name','cacamap' WHERE NOT EXISTS (SELECT 1 FROM metadata WHERE name='name')");
+    q.exec("INSERT INTO metadata SELECT 'format','png' WHERE NOT EXISTS (SELECT 1 FROM metadata WHERE name='format')");
+}
+
+/**
+* destructor, commits what's pending and closes the owner's connection
+* Must run in the thread that created the store, after the workers using it are done.
+*/
+mbtilesTileStore::~mbtilesTileStore()
+{
+    flush();
+    QSqlDatabase::database(ownerConnection, false).close();
+    QSqlDatabase::removeDatabase(ownerConnection);
+}
+
+/**
+* Opens a connection to the file
+* @param name name of the new connection
+* @param busytimeout how long to wait in ms when another connection holds the file
+* @return the connection, check isOpen()
+*/
+QSqlDatabase mbtilesTileStore::open(const QString &name, int busytimeout) const
+{
+    QSqlDatabase db = QSqlDatabase::addDatabase("QSQLITE", name);
+    db.setDatabaseName(fileName);
+    db.setConnectOptions(QString("QSQLITE_BUSY_TIMEOUT=%1").arg(busytimeout));
+    if (!db.open())
+    {
+        qDebug() <<"can't open "<<fileName<<": "<<db.lastError().text();
+    }
+    return db;
+}
+
+/**
+* SQLite connections can't be shared between threads, so each thread
+* opens its own the first time and keeps it until it finishes.
+* @return the calling thread's connection to the file
+*/
+QSqlDatabase mbtilesTileStore::connection()
+{
+    if (QThread::currentThread() == owner)
+    {
+        return QSqlDatabase::database(ownerConnection, false);
+    }
+    if (!mbtilesThreads.hasLocalData())
+    {
+        mbtilesThreads.setLocalData(new mbtilesThreadConnections);
+    }
+    QString name = connectionPrefix + QString::number((quintptr)QThread::currentThread());
+    if (!QSqlDatabase::contains(name))
+    {
+        mbtilesThreads.localData()->names.append(name);
+        return open(name, MBTILES_WORKER_BUSY_TIMEOUT);
+    }
+    return QSqlDatabase::database(name, false);
+}
+
+/**
+* @return true if the file could be opened
+*/
+bool mbtilesTileStore::isOpen()
+{
+    return connection().isOpen();
+}
+
+/**
+* @return row number of the %tile as stored in MBTiles (TMS, counted from the bottom)
+*/
+quint32 mbtilesTileStore::tmsRow(const tileKey &key)
+{
+    return (((quint32)1<<key.zoom()) - 1) - key.y();
+}
+
+QByteArray mbtilesTileStore::read(const tileKey &key)
+{
+    {
+        QMutexLocker lock(&mutex);
+        QHash<tileKey,QByteArray>::const_iterator i = pendingWrites.constFind(key);
+        if (i != pendingWrites.constEnd())
+        {
+            return i.value();
+        }
+    }
+    QSqlQuery q(connection());
+    q.prepare("SELECT tile_data FROM tiles WHERE zoom_level=? AND tile_column=? AND tile_row=?");
+    q.addBindValue(key.zoom());
+    q.addBindValue(key.x());
+    q.addBindValue(tmsRow(key));
+    if (q.exec() && q.next())
+    {
+        return q.value(0).toByteArray();
+    }
+    return QByteArray();
+}
+
+bool mbtilesTileStore::contains(const tileKey &key)
+{
+    {
+        QMutexLocker lock(&mutex);
+        if (pendingWrites.contains(key))
+        {
+            return true;
+        }
+    }
+    QSqlQuery q(connection());
+    q.prepare("SELECT 1 FROM tiles WHERE zoom_level=? AND tile_column=? AND tile_row=?");
+    q.addBindValue(key.zoom());
+    q.addBindValue(key.x());
+    q.addBindValue(tmsRow(key));
+    return q.exec() && q.next();
+}
+
+/**
+* Buffers the %tile, the batch is committed once it's full
+*/
+bool mbtilesTileStore::write(const tileKey &key, const QByteArray &data)
+{
+    int pending;
+    {
+        QMutexLocker lock(&mutex);
+        pendingWrites.insert(key, data);
+        pending = pendingWrites.size();
+    }
+    if (pending >= batchSize)
+    {
+        flush();
+    }
+    return true;
+}
+
+/**
+* @return path of the .mbtiles file
+*/
+QString mbtilesTileStore::location() const
+{
+    return fileName;
+}
+
+bool mbtilesTileStore::remove(const tileKey &key)
+{
+    {
+        QMutexLocker lock(&mutex);
+        pendingWrites.remove(key);
+    }
+    QSqlQuery q(connection());
+    q.prepare("DELETE FROM tiles WHERE zoom_level=? AND tile_column=? AND tile_row=?");
+    q.addBindValue(key.zoom());
+    q.addBindValue(key.x());
+    q.addBindValue(tmsRow(key));
+    return q.exec();
+}
+
+/**
+* @return every %tile in the file with its size.
+* MBTiles doesn't keep access or fetch times, they are all reported as now.
+* Tiles still buffered aren't seen, the owner flushes before scanning.
+*/
+QHash<tileKey,diskTile> mbtilesTileStore::scan()
+{
+    QHash<tileKey,diskTile> tiles;
+    qint64 now = QDateTime::currentMSecsSinceEpoch()/1000;
+    QSqlQuery q(connection());
+    q.setForwardOnly(true);
+    if (q.exec("SELECT zoom_level, tile_column, tile_row, length(tile_data) FROM tiles"))
+    {
+        while (q.next())
+        {
+            int zoom = q.value(0).toInt();
+            quint32 row = q.value(2).toUInt();
+            diskTile t;
+            t.size = q.value(3).toLongLong();
+            t.lastAccess = now;
+            t.fresh.fetched = now;
+            tiles.insert(tileKey(zoom, q.value(1).toUInt(), (((quint32)1<<zoom) - 1) - row), t);
+        }
+    }
+    return tiles;
+}
+
+/**
+* Commits the buffered tiles in a single transaction
+* If a worker holds the file for too long the tiles stay pending and the
+* next flush, e.g. from the next write(), tries again.
+*/
+void mbtilesTileStore::flush()
+{
+    QHash<tileKey,QByteArray> batch;
+    {
+        QMutexLocker lock(&mutex);
+        if (pendingWrites.isEmpty())
+        {
+            return;
+        }
+        batch = pendingWrites;
+    }
+    QSqlDatabase db = connection();
+    if (!db.transaction())
+    {
+        //the file is busy, the batch stays pending for the next flush
+        return;
+    }
+    QSqlQuery q(db);
+    q.prepare("INSERT OR REPLACE INTO tiles (zoom_level, tile_column, tile_row, tile_data) VALUES (?,?,?,?)");
+    QHash<tileKey,QByteArray>::const_iterator i = batch.constBegin();
+    for (; i!=batch.constEnd(); ++i)
+    {
+        q.addBindValue(i.key().zoom());
+        q.addBindValue(i.key().x());
+        q.addBindValue(tmsRow(i.key()));
+        q.addBindValue(i.value());
+        if (!q.exec())
+        {
+            //most likely busy, the whole batch is retried by the next flush
+            qDebug() <<"error writing tile to "<<fileName<<": "<<q.lastError().text();
+            q.finish();
+            db.rollback();
+            return;
+        }
+    }
+    if (!db.commit())
+    {
+        qDebug() <<"error committing tiles to "<<fileName<<": "<<db.lastError().text();
+        db.rollback();
+        return;
+    }
+    //tiles written again while committing stay pending
+    QMutexLocker lock(&mutex);
+    for (i = batch.constBegin(); i!=batch.constEnd(); ++i)
+    {
+        QHash<tileKey,QByteArray>::iterator p = pendingWrites.find(i.key());
+        if (p != pendingWrites.end() && p.value().constData() == i.value().constData())
+        {
+            pendingWrites.erase(p);
+        }
+    }
+}
@@ -0,0 +1,111 @@
+#ifndef TILESTORE_H
+#define TILESTORE_H
+
+#include <QByteArray>
+#include <QHash>
+#include <QSet>
+#include <QString>
+#include <QStringList>
+#include <QMutex>
+#include <QSqlDatabase>
+#include <QThread>
+#include "tilekey.h"
+#include "tilefreshness.h"
+#include "servermanager.h"
+
+/**
+* Index entry of a %tile stored on disk
+*/
+struct diskTile
+{
+    qint64 size;/**< size of the %tile data in bytes. */
+    qint64 lastAccess;/**< last time the %tile was used, in seconds since epoch. */
+    tileFreshness fresh;/**< when it was fetched and how to revalidate it. */
+};
+
+/**
+* Where downloaded tiles are kept
+* read(), remove() and scan() can be called from any thread, they are used by
+* the loader and eviction workers. write() and flush() are called from the
+* thread that owns the store, which flushes before scanning.
+* @see cacaMap::setTileStore()
+*/
+class tileStore
+{
+public:
+    virtual ~tileStore();
+
+    virtual QByteArray read(const tileKey &) = 0;
+    virtual bool write(const tileKey &, const QByteArray &) = 0;
+    virtual bool remove(const tileKey &) = 0;
+    virtual bool contains(const tileKey &);
+    virtual QHash<tileKey,diskTile> scan() = 0;
+    virtual void flush();
+    virtual QString location() const = 0;
+
+    static int copyTiles(tileStore *, tileStore *);
+};
+
+/**
+* One file per %tile in the cache folder, laid out by the tile server templates
+* e.g. map_cache/%z/%x/%y.png
+*/
+class dirTileStore : public tileStore
+{
+public:
+    dirTileStore(const QString &, const servermanager &);
+
+    QByteArray read(const tileKey &);
+    bool write(const tileKey &, const QByteArray &);
+    bool remove(const tileKey &);
+    bool contains(const tileKey &);
+    QHash<tileKey,diskTile> scan();
+    QString location() const;
+
+private:
+    QString folder;/**< root application folder. */
+    QString root;/**< root application folder with a trailing separator, prefix of every %tile path. */
+    servermanager layout;/**< gives the path of each %tile file. */
+    QSet<QString> knownDirs;/**< folders already created by write(). */
+
+    QString tileFile(const tileKey &) const;
+};
+
+/**
+* All the tiles in a single SQLite file using the MBTiles schema
+* Writes are buffered and committed in batches inside one transaction.
+* MBTiles rows are numbered from the bottom (TMS), they are flipped on the way in and out.
+* Every thread gets its own connection, opened the first time it uses the store.
+* The owner's (the thread that created the store) is closed by the destructor,
+* the others when their thread finishes, e.g. when an idle pool thread expires.
+*/
+class mbtilesTileStore : public tileStore
+{
+public:
+    mbtilesTileStore(const QString &, int batchsize=64);
+    ~mbtilesTileStore();
+
+    bool isOpen();
+    QByteArray read(const tileKey &);
+    bool write(const tileKey &, const QByteArray &);
+    bool remove(const tileKey &);
+    bool contains(const tileKey &);
+    QHash<tileKey,diskTile> scan();
+    void flush();
+    QString location() const;
+
+private:
+    QString fileName;/**< path of the .mbtiles file. */
+    QString connectionPrefix;/**< unique prefix for this store's connection names. */
+    QThread *owner;/**< thread that created the store, writes and flushes. */
+    QString ownerConnection;/**< name of the owner's connection. */
+    QHash<tileKey,QByteArray> pendingWrites;/**< tiles waiting for the next commit. */
+    int batchSize;/**< number of pending tiles that triggers a commit. */
+    QMutex mutex;/**< protects pendingWrites. */
+
+    QSqlDatabase open(const QString &, int) const;
+    QSqlDatabase connection();
+    static quint32 tmsRow(const tileKey &);
+};
+
+#endif
@@ -0,0 +1,298 @@
+#include "tiletemplate.h"
+
+/**
+* constructor, the template is empty
+*/
+tileTemplate::tileTemplate()
+{
+    literalLength = 0;
+}
+
+/**
+* constructor
+* @param pattern the template
+* @param _subdomains what %s is replaced by, e.g. a b c
+*/
+tileTemplate::tileTemplate(const QString &pattern, const QStringList &_subdomains)
+{
+    subdomains = _subdomains;
+    parse(pattern);
+}
+
+/**
+* Splits the template into literal text and %tile fields
+* Unknown fields are kept as literal text.
+*/
+void tileTemplate::parse(const QString &pattern)
+{
+    source = pattern;
+    segments.clear();
+    literalLength = 0;
+    QString literal;
+    int i = 0;
+    while (i < pattern.size())
+    {
+        segmentType type = LITERAL;
+        int length = 1;
+        QChar c = pattern.at(i);
+        if (c == '%' && i+1 < pattern.size())
+        {
+            length = 2;
+            switch (pattern.at(i+1).toLatin1())
+            {
+            case 'z': type = ZOOM; break;
+            case 'x': type = X; break;
+            case 'y': type = Y; break;
+            case 'q': type = QUADKEY; break;
+            case 's': type = SUBDOMAIN; break;
+            }
+        }
+        else if (c == '{')
+        {
+            int end = pattern.indexOf('}', i);
+            if (end > i)
+            {
+                QString name = pattern.mid(i+1, end-i-1);
+                length = end-i+1;
+                if (name == "z") type = ZOOM;
+                else if (name == "x") type = X;
+                else if (name == "y") type = Y;
+                else if (name == "q" || name == "quadkey") type = QUADKEY;
+                else if (name == "s") type = SUBDOMAIN;
+            }
+        }
+        if (type == LITERAL)
+        {
+            literal += c;
+            i++;
+            continue;
+        }
+        addLiteral(literal);
+        literal.clear();
+        segment s;
+        s.type = type;
+        segments.append(s);
+        i += length;
+    }
+    addLiteral(literal);
+}
+
+void tileTemplate::addLiteral(const QString &text)
+{
+    if (text.isEmpty())
+    {
+        return;
+    }
+    segment s;
+    s.type = LITERAL;
+    s.text = text;
+    segments.append(s);
+    literalLength += text.size();
+}
+
+/**
+* Sets what %s is replaced by. Each %tile always gets the same one,
+* so it's cached by the server and by proxies under a single url.
+*/
+void tileTemplate::setSubdomains(const QStringList &_subdomains)
+{
+    subdomains = _subdomains;
+}
+
+/**
+* @return the template as given
+*/
+QString tileTemplate::pattern() const
+{
+    return source;
+}
+
+bool tileTemplate::isEmpty() const
+{
+    return segments.isEmpty();
+}
+
+/**
+* @return the template filled in for a %tile
+*/
+QString tileTemplate::format(const tileKey &key) const
+{
+    QString out;
+    format(key.zoom(), key.x(), key.y(), out);
+    return out;
+}
+
+/**
+* Appends the template filled in for a %tile
+* @param key %tile
+* @param out string appended to, reusing it avoids allocations
+*/
+void tileTemplate::format(const tileKey &key, QString &out) const
+{
+    format(key.zoom(), key.x(), key.y(), out);
+}
+
+/**
+* Appends the template filled in for a %tile
+* @param zoom zoom level
+* @param x %tile column
+* @param y %tile row
+* @param out string appended to
+*/
+void tileTemplate::format(int zoom, quint32 x, quint32 y, QString &out) const
+{
+    //numbers are at most 10 digits, the quadkey is zoom digits long
+    out.reserve(out.size() + literalLength + segments.size()*10 + zoom);
+    for (int i=0; i<segments.size(); i++)
+    {
+        const segment &s = segments.at(i);
+        switch (s.type)
+        {
+        case LITERAL:
+            out += s.text;
+            break;
+        case ZOOM:
+            appendNumber(out, (quint32)zoom);
+            break;
+        case X:
+            appendNumber(out, x);
+            break;
+        case Y:
+            appendNumber(out, y);
+            break;
+        case QUADKEY:
+            for (int z=zoom-1; z>=0; z--)
+            {
+                out += QChar('0' + (((x>>z) & 1) | (((y>>z) & 1)<<1)));
+            }
+            break;
+        case SUBDOMAIN:
+            if (!subdomains.isEmpty())
+            {
+                out += subdomains.at((x+y) % subdomains.size());
+            }
+            break;
+        }
+    }
+}
+
+/**
+* Finds the %tile a formatted string stands for, e.g. a file of the cache folder
+* Numbers are read greedily, the caller should format the key again and compare
+* if the template could be ambiguous. Strings with a subdomain never match.
+* @param text formatted template
+* @param key receives the %tile
+* @return false if the text doesn't follow the template or has no full %tile in it
+*/
+bool tileTemplate::match(const QString &text, tileKey &key) const
+{
+    //-1 until read, a field may appear more than once but must agree
+    qint64 fields[3] = {-1, -1, -1};
+    int pos = 0;
+    for (int i=0; i<segments.size(); i++)
+    {
+        const segment &s = segments.at(i);
+        switch (s.type)
+        {
+        case LITERAL:
+            if (text.mid(pos, s.text.size()) != s.text)
+            {
+                return false;
+            }
+            pos += s.text.size();
+            break;
+        case ZOOM:
+        case X:
+        case Y:
+        {
+            quint32 value;
+            if (!readField(text, pos, 10, value))
+            {
+                return false;
+            }
+            qint64 &field = fields[s.type == ZOOM ? 0 : (s.type == X ? 1 : 2)];
+            if (field >= 0 && field != value)
+            {
+                return false;
+            }
+            field = value;
+            break;
+        }
+        case QUADKEY:
+        {
+            int start = pos;
+            quint32 x = 0, y = 0;
+            while (pos < text.size() && pos-start < 30 && text.at(pos) >= '0' && text.at(pos) <= '3')
+            {
+                int digit = text.at(pos).unicode() - '0';
+                x = (x<<1) | (digit & 1);
+                y = (y<<1) | (digit>>1);
+                pos++;
+            }
+            qint64 read[3] = {pos-start, x, y};
+            for (int f=0; f<3; f++)
+            {
+                if (fields[f] >= 0 && fields[f] != read[f])
+                {
+                    return false;
+                }
+                fields[f] = read[f];
+            }
+            break;
+        }
+        case SUBDOMAIN:
+            return false;
+        }
+    }
+    if (pos != text.size() || fields[0] < 0 || fields[1] < 0 || fields[2] < 0 || fields[0] > 30)
+    {
+        return false;
+    }
+    qint64 numtiles = (qint64)1<<fields[0];
+    if (fields[1] >= numtiles || fields[2] >= numtiles)
+    {
+        return false;
+    }
+    key = tileKey((int)fields[0], (quint32)fields[1], (quint32)fields[2]);
+    return true;
+}
+
+/**
+* Reads the decimal number at some position of a string
+* @param text string to read from
+* @param pos where the number starts, moved past it
+* @param maxdigits longest number accepted
+* @param value receives the number
+* @return false if there's no number there
+*/
+bool tileTemplate::readField(const QString &text, int &pos, int maxdigits, quint32 &value)
+{
+    int start = pos;
+    quint64 n = 0;
+    while (pos < text.size() && pos-start < maxdigits && text.at(pos) >= '0' && text.at(pos) <= '9')
+    {
+        n = n*10 + (text.at(pos).unicode() - '0');
+        pos++;
+    }
+    if (pos == start || n > 0xffffffffULL)
+    {
+        return false;
+    }
+    value = (quint32)n;
+    return true;
+}
+
+/**
+* Appends the decimal digits of a number without going through a temporary string
+*/
+void tileTemplate::appendNumber(QString &out, quint32 n)
+{
+    QChar digits[10];
+    int i = 10;
+    do
+    {
+        digits[--i] = QChar('0' + n%10);
+        n /= 10;
+    } while (n);
+    out.append(digits+i, 10-i);
+}
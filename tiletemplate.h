@@ -0,0 +1,50 @@
+#ifndef TILETEMPLATE_H
+#define TILETEMPLATE_H
+
+#include <QString>
+#include <QStringList>
+#include <QVector>
+#include "tilekey.h"
+
+/**
+* A url or path template parsed once into literal text and %tile fields
+* Recognized fields are %z %x %y, %q for the quadkey and %s for a subdomain,
+* and the same in braces: {z} {x} {y} {q} {quadkey} {s}.
+* Formatting appends the pieces straight into the output string, the template
+* is never copied or searched again.
+*/
+class tileTemplate
+{
+public:
+    tileTemplate();
+    tileTemplate(const QString &, const QStringList &subdomains = QStringList());
+
+    void parse(const QString &);
+    void setSubdomains(const QStringList &);
+    QString pattern() const;
+    bool isEmpty() const;
+
+    QString format(const tileKey &) const;
+    void format(const tileKey &, QString &) const;
+    void format(int, quint32, quint32, QString &) const;
+    bool match(const QString &, tileKey &) const;
+
+private:
+    enum segmentType {LITERAL, ZOOM, X, Y, QUADKEY, SUBDOMAIN};
+    struct segment
+    {
+        segmentType type;
+        QString text;/**< the text of a LITERAL segment. */
+    };
+
+    QString source;/**< the template as given. */
+    QVector<segment> segments;/**< the parsed template, in order. */
+    QStringList subdomains;/**< picked from by %s, spread over the tiles. */
+    int literalLength;/**< characters of literal text, to size the output. */
+
+    void addLiteral(const QString &);
+    static void appendNumber(QString &, quint32);
+    static bool readField(const QString &, int &, int, quint32 &);
+};
+
+#endif
@@ -0,0 +1,432 @@
+#include "trackoverlay.h"
+#include <QtMath>
+#include <limits>
+
+/**
+* constructor
+* @param _overlay overlay the result is posted to
+* @param _track id of the track
+* @param _chunk index of the chunk
+*/
+trackSimplifyTask::trackSimplifyTask(trackOverlay *_overlay, int _track, int _chunk)
+{
+    overlay = _overlay;
+    track = _track;
+    chunk = _chunk;
+    generation = 0;
+}
+
+/**
+* Copies the current points of the chunk, appending to it queues a new task from now on
+* @return false if the chunk is gone
+*/
+bool trackSimplifyTask::takePoints()
+{
+    QWriteLocker locker(&overlay->lock);
+    QHash<int,mapTrack>::iterator i = overlay->tracks.find(track);
+    if (i == overlay->tracks.end() || chunk >= i->chunks.size())
+    {
+        return false;
+    }
+    trackChunk &c = i->chunks[chunk];
+    points = c.points;
+    generation = c.generation;
+    c.queued = false;
+    return true;
+}
+
+/**
+* Runs Douglas-Peucker once and keeps, for every point, the largest tolerance
+* it survives. A point's tolerance is capped by the one of the point that split
+* its range, so the points kept for a tolerance always are a subset of the ones
+* kept for a smaller one.
+* @param points line to simplify
+* @param result tolerance of each point, infinite for both ends
+*/
+void trackSimplifyTask::importance(const QPolygonF &points, QVector<qreal> &result)
+{
+    int n = points.size();
+    result.fill(0, n);
+    if (n == 0)
+    {
+        return;
+    }
+    result[0] = std::numeric_limits<qreal>::infinity();
+    result[n-1] = std::numeric_limits<qreal>::infinity();
+    struct range
+    {
+        int first;
+        int last;
+        qreal cap;
+    };
+    QVector<range> stack;
+    range whole = {0, n-1, std::numeric_limits<qreal>::infinity()};
+    stack.append(whole);
+    while (!stack.isEmpty())
+    {
+        range r = stack.takeLast();
+        if (r.last - r.first < 2)
+        {
+            continue;
+        }
+        QPointF a = points.at(r.first);
+        QPointF ab = points.at(r.last) - a;
+        qreal len = QPointF::dotProduct(ab, ab);
+        int farthest = r.first + 1;
+        qreal maxdist = -1;
+        for (int i=r.first+1; i<r.last; i++)
+        {
+            QPointF ap = points.at(i) - a;
+            qreal dist;
+            if (len > 0)
+            {
+                //distance to the line squared
+                qreal cross = ab.x()*ap.y() - ab.y()*ap.x();
+                dist = cross*cross/len;
+            }
+            else
+            {
+                dist = QPointF::dotProduct(ap, ap);
+            }
+            if (dist > maxdist)
+            {
+                maxdist = dist;
+                farthest = i;
+            }
+        }
+        qreal tolerance = qMin(qSqrt(maxdist), r.cap);
+        result[farthest] = tolerance;
+        range left = {r.first, farthest, tolerance};
+        range right = {farthest, r.last, tolerance};
+        stack.append(left);
+        stack.append(right);
+    }
+}
+
+/**
+* Builds the simplified points of the chunk for every zoom level
+*/
+void trackSimplifyTask::run()
+{
+    if (!takePoints())
+    {
+        return;
+    }
+    QVector<qreal> tolerances;
+    importance(points, tolerances);
+    QVector<QPolygonF> lods(TRACK_LOD_LEVELS);
+    QPolygonF kept;
+    for (int z=0; z<TRACK_LOD_LEVELS; z++)
+    {
+        qreal tolerance = TRACK_LOD_TOLERANCE/myMercator::mapSize(z, 256);
+        kept.clear();
+        for (int i=0; i<points.size(); i++)
+        {
+            if (tolerances.at(i) > tolerance)
+            {
+                kept.append(points.at(i));
+            }
+        }
+        //share the points between levels that keep the same ones
+        if (kept.size() == points.size())
+        {
+            lods[z] = points;
+        }
+        else if (z > 0 && kept.size() == lods.at(z-1).size())
+        {
+            lods[z] = lods.at(z-1);
+        }
+        else
+        {
+            lods[z] = kept;
+            lods[z].squeeze();
+        }
+    }
+    QMetaObject::invokeMethod(overlay, "slotChunkSimplified", Qt::QueuedConnection,
+                              Q_ARG(int, track),
+                              Q_ARG(int, chunk),
+                              Q_ARG(int, generation),
+                              Q_ARG(QVector<QPolygonF>, lods));
+}
+
+/**
+* constructor, there are no tracks
+*/
+trackOverlay::trackOverlay(QObject *_parent):QObject(_parent)
+{
+    qRegisterMetaType<QVector<QPolygonF> >("QVector<QPolygonF>");
+    nextId = 1;
+    nextGeneration = 1;
+    pool.setMaxThreadCount(1);
+}
+
+/**
+* destructor, waits for the running task so it doesn't post to a dead object
+*/
+trackOverlay::~trackOverlay()
+{
+    pool.clear();
+    pool.waitForDone();
+}
+
+/**
+* Adds points to the end of a track and queues the chunks that changed
+* Must be called with the write lock held.
+*/
+void trackOverlay::appendWorld(int id, mapTrack &track, const QPolygonF &world)
+{
+    int i = 0;
+    while (i < world.size())
+    {
+        if (track.chunks.isEmpty() || track.chunks.last().points.size() >= TRACK_CHUNK_SIZE)
+        {
+            trackChunk chunk;
+            chunk.generation = 0;
+            chunk.queued = false;
+            if (!track.chunks.isEmpty())
+            {
+                //chunks share their ends so there's no gap between them
+                chunk.points.append(track.chunks.last().points.last());
+            }
+            track.chunks.append(chunk);
+        }
+        trackChunk &chunk = track.chunks.last();
+        int take = qMin(TRACK_CHUNK_SIZE - chunk.points.size(), world.size() - i);
+        chunk.points.reserve(chunk.points.size() + take);
+        for (int j=0; j<take; j++)
+        {
+            chunk.points.append(world.at(i+j));
+        }
+        i += take;
+        chunk.bounds = chunk.points.boundingRect();
+        //drawn with all its points until it's simplified again
+        chunk.lods.clear();
+        chunk.generation = nextGeneration++;
+        //queued after the chunk is full or the points run out,
+        //a task that hasn't started yet will pick the new points up
+        if ((chunk.points.size() >= TRACK_CHUNK_SIZE || i == world.size()) && !chunk.queued)
+        {
+            chunk.queued = true;
+            pool.start(new trackSimplifyTask(this, id, track.chunks.size()-1));
+        }
+    }
+}
+
+/**
+* Adds a track
+* @param geocoords longitudes and latitudes in degrees
+* @param pen how the track is drawn
+* @return id of the track
+*/
+int trackOverlay::addTrack(const QPolygonF &geocoords, const QPen &pen)
+{
+    QPolygonF world = featureOverlay::toWorld(geocoords);
+    QWriteLocker locker(&lock);
+    int id = nextId++;
+    mapTrack &track = tracks[id];
+    track.pen = pen;
+    appendWorld(id, track, world);
+    locker.unlock();
+    emit changed();
+    return id;
+}
+
+/**
+* Adds points to the end of a track, e.g. as a GPS reports them
+* Only the last chunk and the new ones are simplified again.
+* @param id track id
+* @param geocoords longitudes and latitudes in degrees
+* @return false if there's no such track
+*/
+bool trackOverlay::appendPoints(int id, const QPolygonF &geocoords)
+{
+    QPolygonF world = featureOverlay::toWorld(geocoords);
+    QWriteLocker locker(&lock);
+    QHash<int,mapTrack>::iterator i = tracks.find(id);
+    if (i == tracks.end())
+    {
+        return false;
+    }
+    appendWorld(id, *i, world);
+    locker.unlock();
+    emit changed();
+    return true;
+}
+
+/**
+* @return false if there's no such track
+*/
+bool trackOverlay::removeTrack(int id)
+{
+    QWriteLocker locker(&lock);
+    if (!tracks.remove(id))
+    {
+        return false;
+    }
+    locker.unlock();
+    emit changed();
+    return true;
+}
+
+void trackOverlay::clear()
+{
+    pool.clear();
+    QWriteLocker locker(&lock);
+    tracks.clear();
+    locker.unlock();
+    emit changed();
+}
+
+int trackOverlay::count() const
+{
+    QReadLocker locker(&lock);
+    return tracks.size();
+}
+
+/**
+* @return number of points of a track, 0 if there's no such track
+*/
+int trackOverlay::pointCount(int id) const
+{
+    QReadLocker locker(&lock);
+    QHash<int,mapTrack>::const_iterator i = tracks.constFind(id);
+    if (i == tracks.constEnd())
+    {
+        return 0;
+    }
+    int points = 0;
+    for (int c=0; c<i->chunks.size(); c++)
+    {
+        //but the one shared with the previous chunk
+        points += i->chunks.at(c).points.size() - (c > 0 ? 1 : 0);
+    }
+    return points;
+}
+
+/**
+* @return true if every chunk has been simplified
+*/
+bool trackOverlay::isSimplified() const
+{
+    QReadLocker locker(&lock);
+    for (QHash<int,mapTrack>::const_iterator i=tracks.constBegin(); i!=tracks.constEnd(); ++i)
+    {
+        for (int c=0; c<i->chunks.size(); c++)
+        {
+            if (i->chunks.at(c).lods.isEmpty())
+            {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+/**
+* Called in the overlay's thread when a chunk has been simplified
+* Results for chunks that changed or were removed since are dropped.
+*/
+void trackOverlay::slotChunkSimplified(int id, int chunk, int generation, QVector<QPolygonF> lods)
+{
+    QWriteLocker locker(&lock);
+    QHash<int,mapTrack>::iterator i = tracks.find(id);
+    if (i == tracks.end() || chunk >= i->chunks.size() || i->chunks.at(chunk).generation != generation)
+    {
+        return;
+    }
+    i->chunks[chunk].lods = lods;
+    locker.unlock();
+    emit changed();
+}
+
+/**
+* @return zoom level whose simplification fits a zoom level drawn with some %tile size
+*/
+int trackOverlay::lodLevel(int zoom, int tilesize)
+{
+    //a 512 px tile shows the detail of a 256 px one a level deeper
+    for (int size=tilesize; size>256; size>>=1)
+    {
+        zoom++;
+    }
+    for (int size=tilesize; size<256 && zoom>0; size<<=1)
+    {
+        zoom--;
+    }
+    return zoom;
+}
+
+/**
+* Draws the runs of segments of a line that touch an area
+* @param p painter
+* @param points line in world coordinates
+* @param area visible part of the world
+* @param mapsize size of the whole map in px
+* @param dx horizontal offset of the world in the view, in px
+* @param dy vertical offset of the world in the view, in px
+*/
+void trackOverlay::drawClipped(QPainter &p, const QPolygonF &points, const QRectF &area, qreal mapsize, qreal dx, qreal dy)
+{
+    QPolygonF run;
+    for (int i=1; i<points.size(); i++)
+    {
+        QPointF a = points.at(i-1);
+        QPointF b = points.at(i);
+        QRectF segment(qMin(a.x(), b.x()), qMin(a.y(), b.y()), qAbs(b.x() - a.x()), qAbs(b.y() - a.y()));
+        if (!featureIndex::overlaps(segment, area))
+        {
+            if (run.size() > 1)
+            {
+                p.drawPolyline(run);
+            }
+            run.clear();
+            continue;
+        }
+        if (run.isEmpty())
+        {
+            run.append(QPointF(a.x()*mapsize + dx, a.y()*mapsize + dy));
+        }
+        run.append(QPointF(b.x()*mapsize + dx, b.y()*mapsize + dy));
+    }
+    if (run.size() > 1)
+    {
+        p.drawPolyline(run);
+    }
+}
+
+/**
+* Draws the visible part of the tracks with the points kept for the zoom level
+* Where the view wraps around horizontally every copy of the world is drawn.
+*/
+void trackOverlay::paint(QPainter &p, const tileSet &view, int tilesize) const
+{
+    QReadLocker locker(&lock);
+    qreal mapsize = myMercator::mapSize(view.zoom, tilesize);
+    qreal tile = tilesize/mapsize;
+    int level = lodLevel(view.zoom, tilesize);
+    p.save();
+    p.setRenderHint(QPainter::Antialiasing);
+    p.setBrush(Qt::NoBrush);
+    for (QHash<int,mapTrack>::const_iterator i=tracks.constBegin(); i!=tracks.constEnd(); ++i)
+    {
+        qreal margin = i->pen.widthF()/mapsize;
+        QRectF area(view.left*tile - margin, view.top*tile - margin,
+                    (view.right - view.left + 1)*tile + 2*margin, (view.bottom - view.top + 1)*tile + 2*margin);
+        p.setPen(i->pen);
+        for (qint64 k=qFloor(area.left()); k<=qFloor(area.right()); k++)
+        {
+            QRectF copy = area.translated(-k, 0);
+            for (int c=0; c<i->chunks.size(); c++)
+            {
+                const trackChunk &chunk = i->chunks.at(c);
+                if (!featureIndex::overlaps(chunk.bounds, copy))
+                {
+                    continue;
+                }
+                const QPolygonF &points = level < chunk.lods.size() ? chunk.lods.at(level) : chunk.points;
+                drawClipped(p, points, copy, mapsize, k*mapsize - view.originx, -view.originy);
+            }
+        }
+    }
+    p.restore();
+}
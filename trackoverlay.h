@@ -0,0 +1,126 @@
+#ifndef TRACKOVERLAY_H
+#define TRACKOVERLAY_H
+
+#include <QObject>
+#include <QRunnable>
+#include <QThreadPool>
+#include <QPolygonF>
+#include <QVector>
+#include <QHash>
+#include <QList>
+#include <QPen>
+#include <QReadWriteLock>
+#include "mapoverlay.h"
+
+/**
+* tracks are cut in chunks of this many points, each simplified on its own
+*/
+#define TRACK_CHUNK_SIZE 4096
+/**
+* zoom levels a simplified version of each chunk is kept for, deeper ones draw every point
+*/
+#define TRACK_LOD_LEVELS 20
+/**
+* how far in px a simplified line may stray from the track, on 256 px tiles
+*/
+#define TRACK_LOD_TOLERANCE 0.5
+
+class trackOverlay;
+
+/**
+* Simplifies one chunk of a track for every zoom level on a worker thread
+* The points are taken when the task starts, so points appended while it
+* was queued are simplified by the same pass.
+* @see trackOverlay
+*/
+class trackSimplifyTask : public QRunnable
+{
+public:
+    trackSimplifyTask(trackOverlay *, int, int);
+    void run();
+
+    static void importance(const QPolygonF &, QVector<qreal> &);
+
+private:
+    trackOverlay *overlay;/**< receives the simplified chunk. */
+    int track;/**< id of the track. */
+    int chunk;/**< index of the chunk in the track. */
+    int generation;/**< generation of the chunk when the task started. */
+    QPolygonF points;/**< points of the chunk in world coordinates. */
+
+    bool takePoints();
+};
+
+/**
+* A piece of a track
+*/
+struct trackChunk
+{
+    QPolygonF points;/**< world coordinates, starts with the last point of the previous chunk. */
+    QRectF bounds;/**< bounding box of the points. */
+    QVector<QPolygonF> lods;/**< simplified points for each zoom level, empty until simplified. */
+    int generation;/**< bumped when points are appended, older simplifications are dropped. */
+    bool queued;/**< a simplify task is queued and hasn't taken the points yet. */
+};
+
+/**
+* A polyline with its simplified versions
+*/
+struct mapTrack
+{
+    QList<trackChunk> chunks;/**< the track in order. */
+    QPen pen;/**< how it's drawn. */
+};
+
+/**
+* Long polylines, e.g. GPS tracks, drawn with as many points as each zoom level shows
+* Tracks are projected once, cut in chunks and every chunk is simplified with
+* Douglas-Peucker for all zoom levels on a worker thread. Painting only visits
+* the chunks and segments inside the view and uses the points kept for its zoom.
+* Chunks that are still being simplified are drawn with all their points.
+* Appending to a track only simplifies its last chunk again, with at most one
+* pass waiting per chunk however often points are appended.
+* @see changed()
+*/
+class trackOverlay : public QObject, public mapOverlay
+{
+    Q_OBJECT
+
+    friend class trackSimplifyTask;
+
+public:
+    trackOverlay(QObject *_parent=0);
+    ~trackOverlay();
+
+    int addTrack(const QPolygonF &, const QPen &pen = QPen(Qt::blue, 3));
+    bool appendPoints(int, const QPolygonF &);
+    bool removeTrack(int);
+    void clear();
+    int count() const;
+    int pointCount(int) const;
+    bool isSimplified() const;
+
+    void paint(QPainter &, const tileSet &, int) const;
+
+signals:
+    /**
+    * Emitted when a chunk has been simplified or tracks changed, the view should be redrawn
+    */
+    void changed();
+
+private:
+    QThreadPool pool;/**< worker thread simplifying the chunks. */
+    QHash<int,mapTrack> tracks;/**< all tracks by id. */
+    int nextId;/**< id of the next track. */
+    int nextGeneration;/**< generation given to the next modified chunk. */
+    mutable QReadWriteLock lock;/**< static renders may paint from other threads. */
+
+    void appendWorld(int, mapTrack &, const QPolygonF &);
+    static int lodLevel(int, int);
+    static void drawClipped(QPainter &, const QPolygonF &, const QRectF &, qreal, qreal, qreal);
+
+private slots:
+    void slotChunkSimplified(int, int, int, QVector<QPolygonF>);
+};
+
+#endif